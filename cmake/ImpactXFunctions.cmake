@@ -402,6 +402,7 @@ function(impactx_print_summary)
     if(MPI)
         message("    MPI (thread multiple): ${ImpactX_MPI_THREAD_MULTIPLE}")
     endif()
+    message("    PARTICLE PRECISION: ${ImpactX_PARTICLE_PRECISION}")
     message("    PRECISION: ${ImpactX_PRECISION}")
     message("    PYTHON: ${ImpactX_PYTHON}")
     message("    OPENPMD: ${ImpactX_OPENPMD}")
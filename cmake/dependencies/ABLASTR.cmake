@@ -58,6 +58,7 @@ macro(find_ablastr)
         set(WarpX_COMPUTE ${ImpactX_COMPUTE} CACHE INTERNAL "" FORCE)
         set(WarpX_OPENPMD ${ImpactX_OPENPMD} CACHE INTERNAL "" FORCE)
         set(WarpX_PRECISION ${ImpactX_PRECISION} CACHE INTERNAL "" FORCE)
+        set(WarpX_PARTICLE_PRECISION ${ImpactX_PARTICLE_PRECISION} CACHE INTERNAL "" FORCE)
         set(WarpX_MPI ${ImpactX_MPI} CACHE INTERNAL "" FORCE)
         set(WarpX_MPI_THREAD_MULTIPLE ${ImpactX_MPI_THREAD_MULTIPLE} CACHE INTERNAL "" FORCE)
         set(WarpX_IPO ${ImpactX_IPO} CACHE INTERNAL "" FORCE)
@@ -133,7 +134,7 @@ macro(find_ablastr)
         message(FATAL_ERROR "Not yet supported!")
         # TODO: MPI control
         set(COMPONENT_DIM 3D)
-        set(COMPONENT_PRECISION ${ImpactX_PRECISION} P${ImpactX_PRECISION})
+        set(COMPONENT_PRECISION ${ImpactX_PRECISION} P${ImpactX_PARTICLE_PRECISION})
 
         find_package(ABLASTR 23.06 CONFIG REQUIRED COMPONENTS ${COMPONENT_DIM})
         message(STATUS "ABLASTR: Found version '${ABLASTR_VERSION}'")
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022-2023 ImpactX contributors
+# Authors: Axel Huebl, Chad Mitchell
+# License: BSD-3-Clause-LBNL
+#
+# Compare the Gaussian beam with an over-sampled halo (current directory)
+# to the same beam sampled with equal weighting (directory in the first argument).
+#
+
+import sys
+
+import numpy as np
+import openpmd_api as io
+import pandas as pd
+
+
+def read_beams(path):
+    """Read the initial and final beam of a run"""
+    series = io.Series(f"{path}/diags/openPMD/monitor.h5", io.Access.read_only)
+    last_step = list(series.iterations)[-1]
+    initial = series.iterations[1].particles["beam"].to_df()
+    final = series.iterations[last_step].particles["beam"].to_df()
+    return initial, final
+
+
+def read_moments(path):
+    """Read the initial and final reduced beam characteristics of a run"""
+    columns = [
+        "sig_x",
+        "sig_y",
+        "sig_t",
+        "emittance_x",
+        "emittance_y",
+        "emittance_t",
+        "charge_C",
+    ]
+    initial = pd.read_csv(f"{path}/diags/reduced_beam_characteristics", delimiter=r"\s+")
+    final = pd.read_csv(
+        f"{path}/diags/reduced_beam_characteristics_final", delimiter=r"\s+"
+    )
+    return initial[columns].iloc[0].to_numpy(), final[columns].iloc[-1].to_numpy()
+
+
+initial, final = read_beams(".")
+ref_initial, ref_final = read_beams(sys.argv[1])
+
+# beam.npart particles are created, the same number in each shell, with a
+# weighting that differs per shell
+num_particles = 10000
+num_shells = 3
+halo_ratio = 10.0
+print(f"halo sampling: {len(initial)} particles")
+assert len(initial) == num_particles
+assert len(final) == len(initial)
+weightings = np.sort(initial["weighting"].unique())
+assert len(weightings) == num_shells
+for w in weightings:
+    assert abs((initial["weighting"] == w).sum() - num_particles / num_shells) <= 1
+# the shells hold 90%, 9% and 1% of the physical particles
+assert np.isclose(
+    weightings[-1] / weightings[0], (1.0 - 1.0 / halo_ratio) * halo_ratio**2, rtol=1.0e-3
+)
+assert np.allclose(ref_initial["weighting"], ref_initial["weighting"].iloc[0], rtol=0.0)
+
+# the weighted moments and the charge match those of the equal-weight beam
+moments_initial, moments_final = read_moments(".")
+ref_moments_initial, ref_moments_final = read_moments(sys.argv[1])
+
+# the core shell holds 90% of the charge with a third of the particles, so
+# the sampling noise of the weighted moments is about twice that of the
+# equal-weight beam
+rtol = 10.0 * num_particles**-0.5
+for name, moments, ref_moments in [
+    ("initial", moments_initial, ref_moments_initial),
+    ("final", moments_final, ref_moments_final),
+]:
+    print(f"{name} beam:")
+    print(f"  halo sampling: {moments}")
+    print(f"  equal weights: {ref_moments}")
+    print(f"  relative difference={np.abs(moments / ref_moments - 1.0)} (rtol={rtol})")
+    assert np.allclose(moments[:-1], ref_moments[:-1], rtol=rtol, atol=0.0)
+
+    # the weightings are rescaled to carry exactly the bunch charge
+    assert np.isclose(moments[-1], ref_moments[-1], rtol=1.0e-6, atol=0.0)
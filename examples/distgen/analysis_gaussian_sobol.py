@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022-2023 ImpactX contributors
+# Authors: Axel Huebl, Chad Mitchell
+# License: BSD-3-Clause-LBNL
+#
+
+import numpy as np
+import openpmd_api as io
+from scipy.stats import moment
+
+
+def get_moments(beam):
+    """Calculate standard deviations of beam position & momenta
+    and emittance values
+
+    Returns
+    -------
+    sigx, sigy, sigt, emittance_x, emittance_y, emittance_t
+    """
+    sigx = moment(beam["position_x"], moment=2) ** 0.5  # variance -> std dev.
+    sigpx = moment(beam["momentum_x"], moment=2) ** 0.5
+    sigy = moment(beam["position_y"], moment=2) ** 0.5
+    sigpy = moment(beam["momentum_y"], moment=2) ** 0.5
+    sigt = moment(beam["position_t"], moment=2) ** 0.5
+    sigpt = moment(beam["momentum_t"], moment=2) ** 0.5
+
+    epstrms = beam.cov(ddof=0)
+    emittance_x = (
+        sigx**2 * sigpx**2 - epstrms["position_x"]["momentum_x"] ** 2
+    ) ** 0.5
+    emittance_y = (
+        sigy**2 * sigpy**2 - epstrms["position_y"]["momentum_y"] ** 2
+    ) ** 0.5
+    emittance_t = (
+        sigt**2 * sigpt**2 - epstrms["position_t"]["momentum_t"] ** 2
+    ) ** 0.5
+
+    return (sigx, sigy, sigt, emittance_x, emittance_y, emittance_t)
+
+
+# initial beam
+series = io.Series("diags/openPMD/monitor.h5", io.Access.read_only)
+initial = series.iterations[1].particles["beam"].to_df()
+
+# compare number of particles
+num_particles = 4096
+assert num_particles == len(initial)
+
+# exact moments of the input distribution
+sigmaX = 3.9984884770e-5
+sigmaY = 3.9984884770e-5
+sigmaT = 1.0e-3
+sigmaPx = 2.6623538760e-5
+sigmaPy = 2.6623538760e-5
+sigmaPt = 2.0e-3
+muxpx = -0.846574929020762
+muypy = 0.846574929020762
+mutpt = 0.0
+rootx = (1.0 - muxpx**2) ** 0.5
+rooty = (1.0 - muypy**2) ** 0.5
+roott = (1.0 - mutpt**2) ** 0.5
+
+print("Initial Beam:")
+sigx, sigy, sigt, emittance_x, emittance_y, emittance_t = get_moments(initial)
+print(f"  sigx={sigx:e} sigy={sigy:e} sigt={sigt:e}")
+print(
+    f"  emittance_x={emittance_x:e} emittance_y={emittance_y:e} emittance_t={emittance_t:e}"
+)
+
+# random sampling has a relative noise of about num_particles**-0.5 (1.6e-2),
+# the Sobol sequence must be well below that
+atol = 0.0  # ignored
+rtol = 0.25 * num_particles**-0.5
+print(f"  rtol={rtol} (ignored: atol~={atol})")
+
+assert np.allclose(
+    [sigx, sigy, sigt, emittance_x, emittance_y, emittance_t],
+    [
+        sigmaX / rootx,
+        sigmaY / rooty,
+        sigmaT / roott,
+        sigmaX * sigmaPx / rootx,
+        sigmaY * sigmaPy / rooty,
+        sigmaT * sigmaPt / roott,
+    ],
+    rtol=rtol,
+    atol=atol,
+)
@@ -0,0 +1,33 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022-2023 ImpactX contributors
+# Authors: Axel Huebl, Chad Mitchell
+# License: BSD-3-Clause-LBNL
+#
+
+import numpy as np
+import openpmd_api as io
+
+# initial/final beam
+series = io.Series("diags/openPMD/monitor.h5", io.Access.read_only)
+last_step = list(series.iterations)[-1]
+initial = series.iterations[1].particles["beam"].to_df()
+final = series.iterations[last_step].particles["beam"].to_df()
+
+# compare number of particles
+num_particles = 10000
+assert num_particles == len(initial)
+assert num_particles == len(final)
+
+# compare the charge of the beam
+bunch_charge_C = 1.0e-9
+elementary_charge = 1.602176634e-19  # C
+initial_charge = initial["weighting"].sum() * elementary_charge
+final_charge = final["weighting"].sum() * elementary_charge
+print(f"Initial charge: {initial_charge:e} C")
+print(f"Final charge:   {final_charge:e} C")
+
+rtol = 1.0e-6  # loss of a single particle is 1e-4
+atol = 0.0  # ignored
+assert np.isclose(initial_charge, bunch_charge_C, rtol=rtol, atol=atol)
+assert np.isclose(final_charge, bunch_charge_C, rtol=rtol, atol=atol)
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022-2023 ImpactX contributors
+# Authors: Axel Huebl, Chad Mitchell
+# License: BSD-3-Clause-LBNL
+#
+# Compare the expanding beam of a run with a different charge deposition or
+# particle order (current directory) to the default run (directory in the
+# first argument).
+#
+
+import sys
+
+import numpy as np
+import openpmd_api as io
+from scipy.stats import moment
+
+
+def read_beams(path):
+    """Read the initial and final beam of a run"""
+    series = io.Series(f"{path}/diags/openPMD/monitor.h5", io.Access.read_only)
+    last_step = list(series.iterations)[-1]
+    initial = series.iterations[1].particles["beam"].to_df()
+    final = series.iterations[last_step].particles["beam"].to_df()
+    return initial, final
+
+
+def get_moments(beam):
+    """Calculate the standard deviations of the beam position and momentum"""
+    return np.array(
+        [
+            moment(beam[f"{record}_{comp}"], moment=2) ** 0.5  # variance -> std dev.
+            for record in ["position", "momentum"]
+            for comp in ["x", "y", "t"]
+        ]
+    )
+
+
+initial, final = read_beams(".")
+ref_initial, ref_final = read_beams(sys.argv[1])
+
+# both runs start from the same beam and keep all particles
+assert len(initial) == len(ref_initial)
+assert len(final) == len(ref_final)
+assert len(final) == len(initial)
+assert np.allclose(
+    np.sort(initial["position_x"]), np.sort(ref_initial["position_x"]), rtol=0.0, atol=0.0
+)
+
+moments = get_moments(final)
+ref_moments = get_moments(ref_final)
+print(f"this run:    {moments}")
+print(f"default run: {ref_moments}")
+
+# the charge density only differs in the order of floating point additions,
+# so the runs differ by about the relative tolerance of the Poisson solver
+# (algo.mlmg_relative_tolerance = 1e-7)
+rtol = 1.0e-5
+print(f"  relative difference={np.abs(moments / ref_moments - 1.0)} (rtol={rtol})")
+assert np.allclose(moments, ref_moments, rtol=rtol, atol=0.0)
@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022-2023 ImpactX contributors
+# Authors: Axel Huebl, Chad Mitchell
+# License: BSD-3-Clause-LBNL
+#
+# Convergence of the Strang-split space charge kick with the number of slices.
+#
+# The run in the current directory uses 5 slices, the run in the directory in
+# the first argument 10 slices and the reference run in the directory in the
+# second argument 40 slices. All runs start from the same beam.
+#
+
+import sys
+
+import numpy as np
+import openpmd_api as io
+from scipy.stats import moment
+
+
+def get_final_sizes(path):
+    """Standard deviations of the final beam position in x, y, t"""
+    series = io.Series(f"{path}/diags/openPMD/monitor.h5", io.Access.read_only)
+    last_step = list(series.iterations)[-1]
+    final = series.iterations[last_step].particles["beam"].to_df()
+
+    num_particles = 10000
+    assert num_particles == len(final)
+
+    return np.array(
+        [
+            moment(final["position_x"], moment=2) ** 0.5,  # variance -> std dev.
+            moment(final["position_y"], moment=2) ** 0.5,
+            moment(final["position_t"], moment=2) ** 0.5,
+        ]
+    )
+
+
+sizes_n5 = get_final_sizes(".")
+sizes_n10 = get_final_sizes(sys.argv[1])
+sizes_ref = get_final_sizes(sys.argv[2])
+
+error_n5 = np.linalg.norm(sizes_n5 / sizes_ref - 1.0)
+error_n10 = np.linalg.norm(sizes_n10 / sizes_ref - 1.0)
+print(f"Final Beam: sigx, sigy, sigt")
+print(f"  5 slices:  {sizes_n5} (relative error {error_n5:e})")
+print(f"  10 slices: {sizes_n10} (relative error {error_n10:e})")
+print(f"  40 slices: {sizes_ref}")
+
+# second order convergence: halving the slice length reduces the error by 4x,
+# while a first order splitting only reduces it by 2x
+order = np.log2(error_n5 / error_n10)
+print(f"  convergence order={order}")
+assert order > 1.5
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022-2023 ImpactX contributors
+# Authors: Axel Huebl, Chad Mitchell
+# License: BSD-3-Clause-LBNL
+#
+# Compare the long beam with the 2.5D space charge model (current directory)
+# to the same beam with the 3D space charge model (directory in the first argument).
+#
+
+import sys
+
+import numpy as np
+import openpmd_api as io
+from scipy.stats import moment
+
+
+def read_beams(path):
+    """Read the initial and final beam of a run"""
+    series = io.Series(f"{path}/diags/openPMD/monitor.h5", io.Access.read_only)
+    last_step = list(series.iterations)[-1]
+    initial = series.iterations[1].particles["beam"].to_df()
+    final = series.iterations[last_step].particles["beam"].to_df()
+    return initial, final
+
+
+def get_sizes(beam):
+    """Calculate the transverse standard deviations of the beam position"""
+    sigx = moment(beam["position_x"], moment=2) ** 0.5  # variance -> std dev.
+    sigy = moment(beam["position_y"], moment=2) ** 0.5
+    return sigx, sigy
+
+
+initial, final = read_beams(".")
+ref_initial, ref_final = read_beams(sys.argv[1])
+
+# both runs start from the same beam
+assert len(initial) == len(ref_initial)
+assert len(final) == len(ref_final)
+assert np.allclose(
+    np.sort(initial["position_x"]), np.sort(ref_initial["position_x"]), rtol=0.0, atol=0.0
+)
+
+sigx0, sigy0 = get_sizes(initial)
+sigx, sigy = get_sizes(final)
+ref_sigx, ref_sigy = get_sizes(ref_final)
+print(f"2.5D: sigx={sigx:e} sigy={sigy:e}")
+print(f"3D:   sigx={ref_sigx:e} sigy={ref_sigy:e}")
+
+# for a beam ten times longer than wide, the transverse fields of the 2.5D
+# model agree with the 3D fields up to end effects of a few percent, which
+# enter the size growth only
+rtol = 0.05
+growth = np.array([sigx - sigx0, sigy - sigy0])
+ref_growth = np.array([ref_sigx - sigx0, ref_sigy - sigy0])
+print(f"  relative growth difference={np.abs(growth / ref_growth - 1.0)} (rtol={rtol})")
+assert np.allclose(growth, ref_growth, rtol=rtol, atol=0.0)
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022-2023 ImpactX contributors
+# Authors: Axel Huebl, Chad Mitchell
+# License: BSD-3-Clause-LBNL
+#
+# Compare the long beam with mixed precision space charge fields (current directory)
+# to the same beam in double precision (directory in the first argument).
+#
+
+import sys
+
+import numpy as np
+import openpmd_api as io
+from scipy.stats import moment
+
+
+def read_beams(path):
+    """Read the initial and final beam of a run"""
+    series = io.Series(f"{path}/diags/openPMD/monitor.h5", io.Access.read_only)
+    last_step = list(series.iterations)[-1]
+    initial = series.iterations[1].particles["beam"].to_df()
+    final = series.iterations[last_step].particles["beam"].to_df()
+    return initial, final
+
+
+def get_sizes(beam):
+    """Calculate the transverse standard deviations of the beam position"""
+    sigx = moment(beam["position_x"], moment=2) ** 0.5  # variance -> std dev.
+    sigy = moment(beam["position_y"], moment=2) ** 0.5
+    return np.array([sigx, sigy])
+
+
+initial, final = read_beams(".")
+ref_initial, ref_final = read_beams(sys.argv[1])
+
+# both runs start from the same beam
+assert len(initial) == len(ref_initial)
+assert len(final) == len(ref_final)
+assert np.allclose(
+    np.sort(initial["position_x"]), np.sort(ref_initial["position_x"]), rtol=0.0, atol=0.0
+)
+
+sig0 = get_sizes(initial)
+sig = get_sizes(final)
+ref_sig = get_sizes(ref_final)
+print(f"mixed precision:  sigx={sig[0]:e} sigy={sig[1]:e}")
+print(f"double precision: sigx={ref_sig[0]:e} sigy={ref_sig[1]:e}")
+
+# the single precision rounding of the guard cell sums and of the 2.5D
+# allreduce enters the space charge kick with a relative error of about
+# 1e-7 per slice, well below the growth of the beam sizes
+rtol = 1.0e-4
+growth = sig - sig0
+ref_growth = ref_sig - sig0
+print(f"  relative growth difference={np.abs(growth / ref_growth - 1.0)} (rtol={rtol})")
+assert np.allclose(growth, ref_growth, rtol=rtol, atol=0.0)
+
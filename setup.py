@@ -101,7 +101,7 @@ class CMakeBuild(build_ext):
             "-DImpactX_COMPUTE=" + ImpactX_COMPUTE,
             "-DImpactX_MPI:BOOL=" + ImpactX_MPI,
             "-DImpactX_PRECISION=" + ImpactX_PRECISION,
-            #'-DImpactX_PARTICLES_PRECISION=' + ImpactX_PARTICLES_PRECISION,
+            "-DImpactX_PARTICLE_PRECISION=" + ImpactX_PARTICLE_PRECISION,
             "-DImpactX_PYTHON:BOOL=ON",
             ## dependency control (developers & package managers)
             #'-DImpactX_pyamrex_internal=' + ImpactX_pyamrex_internal,
@@ -181,6 +181,9 @@ PYIMPACTX_libdir = os.environ.get("PYIMPACTX_LIBDIR")
 ImpactX_COMPUTE = os.environ.get("IMPACTX_COMPUTE", "OMP")
 ImpactX_MPI = os.environ.get("IMPACTX_MPI", "OFF")
 ImpactX_PRECISION = os.environ.get("IMPACTX_PRECISION", "DOUBLE")
+ImpactX_PARTICLE_PRECISION = os.environ.get(
+    "IMPACTX_PARTICLE_PRECISION", ImpactX_PRECISION
+)
 #   already prepared as a list 1;2;3
 ImpactX_SPACEDIM = os.environ.get("IMPACTX_SPACEDIM", "3")
 BUILD_SHARED_LIBS = os.environ.get("IMPACTX_BUILD_SHARED_LIBS", "OFF")
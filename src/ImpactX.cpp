@@ -12,9 +12,16 @@
 #include "particles/ImpactXParticleContainer.H"
 #include "particles/Push.H"
 #include "particles/diagnostics/DiagnosticOutput.H"
+#include "particles/diagnostics/StagingBuffer.H"
+#include "particles/spacecharge/AdaptiveUpdate.H"
 #include "particles/spacecharge/ForceFromSelfFields.H"
 #include "particles/spacecharge/GatherAndPush.H"
+#include "particles/spacecharge/HaloParticles.H"
 #include "particles/spacecharge/PoissonSolve.H"
+#include "particles/spacecharge/PoissonSolve2p5D.H"
+#include "particles/spacecharge/SliceCount.H"
+#include "particles/spacecharge/ParticleDecomposition.H"
+#include "particles/spacecharge/SpaceChargeAtFixedS.H"
 #include "particles/transformation/CoordinateTransformation.H"
 
 #include <ablastr/warn_manager/WarnManager.H>
@@ -22,14 +29,62 @@
 #include <AMReX.H>
 #include <AMReX_AmrParGDB.H>
 #include <AMReX_BLProfiler.H>
+#include <AMReX_ParallelDescriptor.H>
 #include <AMReX_Print.H>
 #include <AMReX_Utility.H>
 
+#include <algorithm>
 #include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <variant>
 
 
 namespace impactx
 {
+namespace
+{
+    /** Restore the number of slices of an element when leaving its push
+     *
+     * The number of slices of elements of finite length is changed while
+     * pushing through them, for the automatic slice count and for Strang
+     * splitting. This restores the lattice value also if the push throws.
+     */
+    class RestoreSliceCount
+    {
+    public:
+        explicit RestoreSliceCount (KnownElements & element_variant)
+            : m_element_variant(element_variant)
+        {
+            std::visit([this](auto &&element) {
+                using Element = std::decay_t<decltype(element)>;
+                if constexpr (std::is_base_of_v<elements::Thick, Element>) {
+                    m_nslice = element.nslice();
+                }
+            }, m_element_variant);
+        }
+
+        RestoreSliceCount (RestoreSliceCount const &) = delete;
+        RestoreSliceCount & operator= (RestoreSliceCount const &) = delete;
+
+        ~RestoreSliceCount ()
+        {
+            std::visit([this](auto &&element) {
+                using Element = std::decay_t<decltype(element)>;
+                if constexpr (std::is_base_of_v<elements::Thick, Element>) {
+                    element.set_nslice(m_nslice);
+                }
+            }, m_element_variant);
+        }
+
+    private:
+        KnownElements & m_element_variant;
+        int m_nslice = 1;
+    };
+} // namespace
+
     ImpactX::ImpactX ()
         : AmrCore(initialization::init_amr_core()),
           m_particle_container(std::make_unique<ImpactXParticleContainer>(this))
@@ -65,6 +120,9 @@ namespace impactx
 
         validate();
 
+        // particles added from Python might carry rank-local values of qm and the weighting
+        m_particle_container->SyncRealAttributes();
+
         // a global step for diagnostics including space charge slice steps in elements
         //   before we start the evolve loop, we are in "step 0" (initial state)
         int global_step = 0;
@@ -83,19 +141,19 @@ namespace impactx
             pp_diag.queryAdd("file_min_digits", file_min_digits);
 
             // print initial reference particle to file
-            diagnostics::DiagnosticOutput(*m_particle_container,
+            diagnostics::DiagnosticOutput(*m_particle_container, m_diag_staging,
                                           diagnostics::OutputType::PrintRefParticle,
                                           "diags/ref_particle",
                                           global_step);
 
             // print the initial values of the two invariants H and I
             std::string diag_name = amrex::Concatenate("diags/nonlinear_lens_invariants_", global_step, file_min_digits);
-            diagnostics::DiagnosticOutput(*m_particle_container,
+            diagnostics::DiagnosticOutput(*m_particle_container, m_diag_staging,
                                           diagnostics::OutputType::PrintNonlinearLensInvariants,
                                           diag_name);
 
             // print the initial values of reduced beam characteristics
-            diagnostics::DiagnosticOutput(*m_particle_container,
+            diagnostics::DiagnosticOutput(*m_particle_container, m_diag_staging,
                                           diagnostics::OutputType::PrintReducedBeamCharacteristics,
                                           "diags/reduced_beam_characteristics");
 
@@ -106,6 +164,110 @@ namespace impactx
         pp_algo.queryAdd("space_charge", space_charge);
         amrex::Print() << " Space Charge effects: " << space_charge << "\n";
 
+        std::string space_charge_model = "3D";
+        pp_algo.queryAdd("space_charge_model", space_charge_model);
+        if (space_charge_model != "3D" && space_charge_model != "2.5D")
+            throw std::runtime_error("algo.space_charge_model must be 3D or 2.5D but is: " + space_charge_model);
+        if (space_charge)
+            amrex::Print() << " Space Charge model: " << space_charge_model << "\n";
+
+        // adaptive space charge update cadence
+        bool space_charge_adaptive = false;
+        amrex::Real space_charge_adaptive_tolerance = 0.01;
+        pp_algo.queryAdd("space_charge_adaptive", space_charge_adaptive);
+        pp_algo.queryAdd("space_charge_adaptive_tolerance", space_charge_adaptive_tolerance);
+        // beam moments at the last space charge field calculation
+        std::optional<spacecharge::BeamMoments> last_solve_moments;
+        int num_skipped_solves = 0;
+
+        // far halo particles outside of a mesh that is sized after the beam core
+        amrex::Real prob_containment = 1.0;
+        amrex::ParmParse("geometry").query("prob_containment", prob_containment);
+        bool const far_halo = prob_containment < 1.0;
+        spacecharge::HaloContainer halo = m_particle_container->make_alike();
+        // restored halo particles are not in the tile of their position
+        bool halo_restored = false;
+
+        // field gather: from precomputed force fields or from the potential
+        std::string field_gather = "force";
+        pp_algo.queryAdd("field_gather", field_gather);
+        if (field_gather != "force" && field_gather != "potential")
+            throw std::runtime_error("algo.field_gather must be force or potential but is: " + field_gather);
+
+        // single precision halo exchange of the space charge fields and 2.5D iterations
+        bool mixed_precision_fields = false;
+        pp_algo.queryAdd("mixed_precision_fields", mixed_precision_fields);
+
+        // parallel decomposition: particles stay on their MPI rank and
+        // deposit to / gather from a replicated mesh
+        bool const particle_decomposition = spacecharge::ParticleDecomposition();
+        if (space_charge && particle_decomposition) {
+            spacecharge::CheckParticleDecomposition(*m_particle_container);
+            amrex::Print() << " Space Charge decomposition: particle\n";
+        }
+
+        // coordinates of the space charge calculation: transform the particles
+        // to fixed t and back, or compute their coordinates at fixed t on the fly
+        std::string space_charge_transform = "particles";
+        pp_algo.queryAdd("space_charge_transform", space_charge_transform);
+        if (space_charge_transform != "particles" && space_charge_transform != "on_the_fly")
+            throw std::runtime_error("algo.space_charge_transform must be particles or on_the_fly but is: " + space_charge_transform);
+        // on the fly, particles are not redistributed, so all boxes must be local
+        bool const on_the_fly_requested = space_charge && space_charge_transform == "on_the_fly";
+        if (on_the_fly_requested &&
+            (amrex::ParallelDescriptor::NProcs() != 1 || maxLevel() != 0 || far_halo))
+        {
+            throw std::runtime_error(
+                "algo.space_charge_transform = on_the_fly needs a single MPI process, "
+                "a single mesh-refinement level and geometry.prob_containment = 1.");
+        }
+
+        // periodic reordering of the particles for memory locality
+        int sort_interval = 0;
+        std::string sort_type = "cell";
+        pp_algo.queryAdd("sort_interval", sort_interval);
+        pp_algo.queryAdd("sort_type", sort_type);
+        if (sort_type != "cell" && sort_type != "morton")
+            throw std::runtime_error("algo.sort_type must be cell or morton but is: " + sort_type);
+
+        // convergence information of the Poisson solver, per slice step
+        if (diag_enable && space_charge) {
+            amrex::PrintToFile("diags/poisson_solver")
+                << "step lev num_iters initial_residual final_residual\n";
+        }
+
+        // refined levels and load balance: updated every this many space charge field calculations
+        int regrid_int = 1;
+        int load_balance_interval = 0;
+        amrex::ParmParse("amr").queryAdd("regrid_int", regrid_int);
+        pp_algo.queryAdd("load_balance_interval", load_balance_interval);
+        int num_field_calculations = 0;
+
+        // load balance of the MPI ranks, per slice step with space charge
+        if (diag_enable && space_charge && !particle_decomposition) {
+            amrex::PrintToFile("diags/load_balance") << "step lev efficiency\n";
+        }
+
+        // placement of the space charge kick in each slice: before the push
+        // through the slice, or in its middle between two half slices
+        std::string space_charge_splitting = "kick_drift";
+        pp_algo.queryAdd("space_charge_splitting", space_charge_splitting);
+        if (space_charge_splitting != "kick_drift" && space_charge_splitting != "strang")
+            throw std::runtime_error("algo.space_charge_splitting must be kick_drift or strang but is: " + space_charge_splitting);
+        bool const strang_splitting = space_charge && space_charge_splitting == "strang";
+
+        // automatic number of space charge slices per element
+        bool nslice_auto = false;
+        pp_algo.queryAdd("nslice_auto", nslice_auto);
+        nslice_auto = nslice_auto && space_charge;
+        spacecharge::SliceCountLimits slice_count_limits;
+        if (nslice_auto) {
+            slice_count_limits = spacecharge::ReadSliceCountLimits();
+            if (diag_enable) {
+                amrex::PrintToFile("diags/nslice_auto") << "step s element nslice\n";
+            }
+        }
+
         // periods through the lattice
         int periods = 1;
         amrex::ParmParse("lattice").queryAdd("periods", periods);
@@ -124,6 +286,39 @@ namespace impactx
                     slice_ds = element.ds() / nslice;
                 }, element_variant);
 
+                // automatic number of slices from the beam moments at the element entrance
+                //   the number of slices of the lattice is restored after the element
+                RestoreSliceCount const restore_slice_count(element_variant);
+                if (nslice_auto) {
+                    std::visit([&](auto &&element) {
+                        using Element = std::decay_t<decltype(element)>;
+                        if constexpr (std::is_base_of_v<elements::Thick, Element>) {
+                            nslice = spacecharge::AutoSliceCount(*m_particle_container, element.ds(), slice_count_limits);
+                            element.set_nslice(nslice);
+                            slice_ds = element.ds() / nslice;
+
+                            amrex::Print() << " Element " << element.name << ": nslice=" << nslice << " (auto)\n";
+                            if (diag_enable) {
+                                amrex::PrintToFile("diags/nslice_auto")
+                                    << global_step << " " << m_particle_container->GetRefParticle().s << " "
+                                    << element.name << " " << nslice << "\n";
+                            }
+                        }
+                    }, element_variant);
+                }
+
+                // Strang splitting: push through elements of finite length in half slices
+                bool split_slices = false;
+                if (strang_splitting) {
+                    std::visit([&split_slices, nslice](auto &&element) {
+                        using Element = std::decay_t<decltype(element)>;
+                        if constexpr (std::is_base_of_v<elements::Thick, Element>) {
+                            element.set_nslice(2 * nslice);
+                            split_slices = true;
+                        }
+                    }, element_variant);
+                }
+
                 // sub-steps for space charge within the element
                 for (int slice_step = 0; slice_step < nslice; ++slice_step) {
                     BL_PROFILE("ImpactX::evolve::slice_step");
@@ -131,46 +326,230 @@ namespace impactx
                     amrex::Print() << " ++++ Starting global_step=" << global_step
                                    << " slice_step=" << slice_step << "\n";
 
+                    // first half slice
+                    if (split_slices) {
+                        Push(*m_particle_container, element_variant, global_step);
+                    }
+
                     // Space-charge calculation: turn off if there is only 1 particle
                     if (space_charge &&
                         m_particle_container->TotalNumberOfParticles(false, false) > 1) {
 
+                        // compute x,y,z on the fly
+                        bool const on_the_fly = on_the_fly_requested;
+
                         // transform from x',y',t to x,y,z
-                        transformation::CoordinateTransformation(
-                                *m_particle_container,
-                                transformation::Direction::to_fixed_t);
+                        if (!on_the_fly) {
+                            transformation::CoordinateTransformation(
+                                    *m_particle_container,
+                                    transformation::Direction::to_fixed_t);
+                        }
 
                         // Note: The following operation assume that
                         // the particles are in x, y, z coordinates.
 
-                        // Resize the mesh, based on `m_particle_container` extent
-                        ResizeMesh();
-
-                        // Redistribute particles in the new mesh in x, y, z
-                        m_particle_container->Redistribute();
-
-                        // charge deposition
-                        m_particle_container->DepositCharge(m_rho, this->refRatio());
-
-                        // poisson solve in x,y,z
-                        spacecharge::PoissonSolve(*m_particle_container, m_rho, m_phi);
-
-                        // calculate force in x,y,z
-                        spacecharge::ForceFromSelfFields(m_space_charge_field,
-                                                         m_phi,
-                                                         this->geom);
+                        // adaptive cadence: skip the field calculation if the beam barely changed
+                        bool update_fields = true;
+                        spacecharge::BeamMoments moments{};
+                        if (space_charge_adaptive) {
+                            moments = spacecharge::GetBeamMoments(*m_particle_container, on_the_fly);
+                            update_fields = !last_solve_moments.has_value() ||
+                                            spacecharge::NeedsFieldUpdate(*last_solve_moments, moments,
+                                                                          this->Geom(0),
+                                                                          space_charge_adaptive_tolerance);
+
+                            // particles outside of the mesh of the last calculation would be
+                            // lost when they are redistributed on it (or not deposited on the fly)
+                            //   particles outside of the beam core are kicked as halo particles
+                            if (!update_fields && !far_halo) {
+                                update_fields = !spacecharge::BeamFitsMesh(*m_particle_container,
+                                                                           this->Geom(0), on_the_fly);
+                            }
+                        }
+
+                        // reorder particles in memory after they were redistributed,
+                        //   before the charge deposition and the field gather
+                        bool const sort_step = !on_the_fly && !particle_decomposition &&
+                                               sort_interval > 0 && global_step % sort_interval == 0;
+
+                        if (update_fields) {
+                            // the intervals of refinement and load balancing count field calculations,
+                            //   so slice steps that reuse the fields do not skip them
+                            num_field_calculations++;
+                            bool const regrid_step = regrid_int > 0 && num_field_calculations % regrid_int == 0;
+                            bool const load_balance_step = load_balance_interval > 0 &&
+                                                           num_field_calculations % load_balance_interval == 0;
+
+                            // Resize the mesh, based on `m_particle_container` extent
+                            int const mesh_shift_cells = ResizeMesh(on_the_fly);
+
+                            // adjust the number of cells to the beam
+                            bool regridded = UpdateGridResolution(on_the_fly);
+
+                            // cut the mesh into slabs of equal particle count along z
+                            if (!particle_decomposition) {
+                                regridded = UpdateSlabDecomposition(on_the_fly) || regridded;
+                            }
+
+                            // on the fly, particles are deposited from the tile they are stored in
+                            if (on_the_fly && this->boxArray(0).size() != 1) {
+                                throw std::runtime_error(
+                                    "algo.space_charge_transform = on_the_fly needs a mesh that is a single box, "
+                                    "but the mesh has " + std::to_string(this->boxArray(0).size()) + " boxes. "
+                                    "Increase amr.max_grid_size.");
+                            }
+
+                            // particles outside of the mesh are not deposited
+                            if (far_halo) { spacecharge::ExtractHaloParticles(*m_particle_container, halo); }
+
+                            // Redistribute particles in the new mesh in x, y, z
+                            //   if the mesh was only shifted by a few cells, exchange particles
+                            //   with the boxes as far as the farthest particle left its box
+                            //   on the fly, particles are deposited from the tile they are stored in
+                            if (!on_the_fly && !particle_decomposition) {
+                                bool const new_boxes = mesh_shift_cells < 0 || regridded;
+                                int const cells_moved = new_boxes || halo_restored ? -1 :
+                                    spacecharge::CellsOutsideOfBoxes(*m_particle_container);
+                                if (cells_moved >= 0)
+                                    m_particle_container->Redistribute(0, -1, 0, std::max(mesh_shift_cells, cells_moved) + 1);
+                                else
+                                    m_particle_container->Redistribute();
+                                halo_restored = false;
+
+                                // move boxes between MPI ranks after their particle count
+                                bool const balanced = load_balance_step && LoadBalance();
+                                if (balanced) {
+                                    m_particle_container->Redistribute();
+                                }
+
+                                // particles in new tiles: place them in the NUMA domain of their threads
+                                if (new_boxes || balanced) {
+                                    m_particle_container->NumaFirstTouch();
+                                }
+
+                                if (diag_enable) {
+                                    amrex::PrintToFile load_balance_diag("diags/load_balance");
+                                    for (int lev = 0; lev <= finestLevel(); ++lev) {
+                                        load_balance_diag << global_step << " " << lev << " "
+                                                          << LoadBalanceEfficiency(lev) << "\n";
+                                    }
+                                }
+                            }
+                            if (sort_step) { m_particle_container->SortParticles(sort_type); }
+
+                            // charge deposition
+                            if (on_the_fly)
+                                spacecharge::DepositChargeAtFixedS(*m_particle_container, m_rho,
+                                                                   mixed_precision_fields);
+                            else if (particle_decomposition)
+                                spacecharge::DepositChargeReplicated(*m_particle_container, m_rho,
+                                                                     mixed_precision_fields);
+                            else
+                                m_particle_container->DepositCharge(m_rho, this->refRatio(),
+                                                                    mixed_precision_fields,
+                                                                    sort_interval > 0);
+
+                            // mesh refinement: refine the core of the beam and
+                            // deposit the particles on the new levels
+                            if (!on_the_fly && regrid_step && UpdateRefinedLevels()) {
+                                m_particle_container->Redistribute();
+                                m_particle_container->DepositCharge(m_rho, this->refRatio(),
+                                                                    mixed_precision_fields,
+                                                                    sort_interval > 0);
+                            }
+
+                            // poisson solve in x,y,z
+                            //   the potential of the previous slice step is the initial guess
+                            amrex::Vector<spacecharge::PoissonSolveStats> const solver_stats =
+                                space_charge_model == "2.5D" ?
+                                spacecharge::PoissonSolve2p5D(*m_particle_container, m_rho, m_phi,
+                                                              mixed_precision_fields) :
+                                spacecharge::PoissonSolve(*m_particle_container, m_rho, m_phi,
+                                                          this->Geom(), this->boxArray(),
+                                                          this->DistributionMap(), this->refRatio(),
+                                                          mixed_precision_fields);
+
+                            if (diag_enable) {
+                                amrex::PrintToFile poisson_diag("diags/poisson_solver");
+                                for (int lev = 0; lev < static_cast<int>(solver_stats.size()); ++lev) {
+                                    poisson_diag << global_step << " " << lev << " "
+                                                 << solver_stats[lev].num_iters << " "
+                                                 << solver_stats[lev].initial_residual << " "
+                                                 << solver_stats[lev].final_residual << "\n";
+                                }
+                            }
+
+                            // calculate force in x,y,z
+                            if (field_gather == "force") {
+                                spacecharge::ForceFromSelfFields(m_space_charge_field,
+                                                                 m_phi,
+                                                                 this->geom);
+                            }
+
+                            if (space_charge_adaptive) { last_solve_moments = moments; }
+                        } else {
+                            // keep the mesh of the last field calculation and reuse its fields
+                            if (far_halo) { spacecharge::ExtractHaloParticles(*m_particle_container, halo); }
+
+                            // particles keep moving in slice steps that reuse the fields: exchange
+                            //   them with the boxes as far as the farthest particle left its box
+                            if (!on_the_fly && !particle_decomposition) {
+                                int const cells_moved = halo_restored ? -1 :
+                                    spacecharge::CellsOutsideOfBoxes(*m_particle_container);
+                                if (cells_moved >= 0)
+                                    m_particle_container->Redistribute(0, -1, 0, cells_moved + 1);
+                                else
+                                    m_particle_container->Redistribute();
+                                halo_restored = false;
+                            }
+                            if (sort_step) { m_particle_container->SortParticles(sort_type); }
+                            num_skipped_solves++;
+                        }
 
                         // gather and space-charge push in x,y,z , assuming the space-charge
                         // field is the same before/after transformation
-                        // TODO: This is currently using linear order.
-                        spacecharge::GatherAndPush(*m_particle_container,
-                                                   m_space_charge_field,
-                                                   this->geom,
-                                                   slice_ds);
+                        //   on the fly, this also transforms back to x',y',t
+                        if (on_the_fly) {
+                            spacecharge::GatherAndPushAtFixedS(*m_particle_container,
+                                                               m_space_charge_field,
+                                                               m_phi,
+                                                               this->geom,
+                                                               slice_ds,
+                                                               field_gather == "potential",
+                                                               mixed_precision_fields);
+                        } else if (particle_decomposition) {
+                            spacecharge::GatherAndPushReplicated(*m_particle_container,
+                                                                 m_space_charge_field,
+                                                                 m_phi,
+                                                                 this->geom,
+                                                                 slice_ds,
+                                                                 field_gather == "potential",
+                                                                 mixed_precision_fields);
+                        } else if (field_gather == "potential") {
+                            spacecharge::GatherAndPushFromPotential(*m_particle_container,
+                                                                    m_phi,
+                                                                    this->geom,
+                                                                    slice_ds,
+                                                                    mixed_precision_fields);
+                        } else {
+                            // TODO: This is currently using linear order.
+                            spacecharge::GatherAndPush(*m_particle_container,
+                                                       m_space_charge_field,
+                                                       this->geom,
+                                                       slice_ds);
+                        }
+
+                        // far-field push of the particles outside of the mesh
+                        if (far_halo) {
+                            spacecharge::HaloPush(*m_particle_container, halo, slice_ds);
+                            halo_restored = spacecharge::RestoreHaloParticles(*m_particle_container, halo);
+                        }
 
                         // transform from x,y,z to x',y',t
-                        transformation::CoordinateTransformation(*m_particle_container,
-                                                                 transformation::Direction::to_fixed_s);
+                        if (!on_the_fly) {
+                            transformation::CoordinateTransformation(*m_particle_container,
+                                                                     transformation::Direction::to_fixed_s);
+                        }
                     }
 
                     // for later: original Impact implementation as an option
@@ -184,6 +563,7 @@ namespace impactx
                     // assuming that the distribution did not change
 
                     // push all particles with external maps
+                    //   with Strang splitting, this is the second half slice
                     Push(*m_particle_container, element_variant, global_step);
 
                     // just prints an empty newline at the end of the slice_step
@@ -195,14 +575,14 @@ namespace impactx
 
                     if (diag_enable && slice_step_diagnostics) {
                         // print slice step reference particle to file
-                        diagnostics::DiagnosticOutput(*m_particle_container,
+                        diagnostics::DiagnosticOutput(*m_particle_container, m_diag_staging,
                                                       diagnostics::OutputType::PrintRefParticle,
                                                       "diags/ref_particle",
                                                       global_step,
                                                       true);
 
                         // print slice step reduced beam characteristics to file
-                        diagnostics::DiagnosticOutput(*m_particle_container,
+                        diagnostics::DiagnosticOutput(*m_particle_container, m_diag_staging,
                                                       diagnostics::OutputType::PrintReducedBeamCharacteristics,
                                                       "diags/reduced_beam_characteristics",
                                                       global_step,
@@ -218,22 +598,26 @@ namespace impactx
             } // end beamline element loop
         } // end periods though the lattice loop
 
+        if (space_charge_adaptive) {
+            amrex::Print() << " Space charge field calculations skipped: " << num_skipped_solves << "\n";
+        }
+
         if (diag_enable)
         {
             // print final reference particle to file
-            diagnostics::DiagnosticOutput(*m_particle_container,
+            diagnostics::DiagnosticOutput(*m_particle_container, m_diag_staging,
                                           diagnostics::OutputType::PrintRefParticle,
                                           "diags/ref_particle_final",
                                           global_step);
 
             // print the final values of the two invariants H and I
-            diagnostics::DiagnosticOutput(*m_particle_container,
+            diagnostics::DiagnosticOutput(*m_particle_container, m_diag_staging,
                                           diagnostics::OutputType::PrintNonlinearLensInvariants,
                                           "diags/nonlinear_lens_invariants_final",
                                           global_step);
 
             // print the final values of the reduced beam characteristics
-            diagnostics::DiagnosticOutput(*m_particle_container,
+            diagnostics::DiagnosticOutput(*m_particle_container, m_diag_staging,
                                           diagnostics::OutputType::PrintReducedBeamCharacteristics,
                                           "diags/reduced_beam_characteristics_final",
                                           global_step);
@@ -246,6 +630,5 @@ namespace impactx
                 element.finalize();
             }, element_variant);
         }
-
     }
 } // namespace impactx
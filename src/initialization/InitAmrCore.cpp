@@ -24,6 +24,7 @@
 #include <AMReX_Vector.H>
 
 #include <stdexcept>
+#include <string>
 
 
 namespace impactx::initialization
@@ -115,11 +116,16 @@ namespace details
         // Domain index space
         amrex::AmrInfo amr_info;
         const int nprocs = amrex::ParallelDescriptor::NProcs();
-        const amrex::IntVect high_end = amr_info.blocking_factor[0]
-                                        * amrex::IntVect(AMREX_D_DECL(nprocs,1,1)) - amrex::IntVect(1);
+        //   with longitudinal slabs, the boxes of the ranks are lined up along z
+        amrex::ParmParse pp_amr("amr");
+        std::string domain_decomposition = "boxes";
+        pp_amr.query("domain_decomposition", domain_decomposition);
+        const amrex::IntVect boxes_per_dim = domain_decomposition == "z_slabs" ?
+            amrex::IntVect(AMREX_D_DECL(1,1,nprocs)) :
+            amrex::IntVect(AMREX_D_DECL(nprocs,1,1));
+        const amrex::IntVect high_end = amr_info.blocking_factor[0] * boxes_per_dim - amrex::IntVect(1);
         amrex::Box domain(amrex::IntVect(0), high_end);
         //   adding amr.n_cell for consistency
-        amrex::ParmParse pp_amr("amr");
         auto const n_cell_iv = domain.size();
         amrex::Vector<int> n_cell_v(n_cell_iv.begin(), n_cell_iv.end());
         pp_amr.addarr("n_cell", n_cell_v);
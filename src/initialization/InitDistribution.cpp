@@ -10,26 +10,132 @@
 #include "ImpactX.H"
 #include "particles/ImpactXParticleContainer.H"
 #include "particles/distribution/All.H"
+#include "particles/spacecharge/HaloParticles.H"
+#include "particles/spacecharge/ParticleDecomposition.H"
 
 #include <ablastr/constant.H>
 #include <ablastr/warn_manager/WarnManager.H>
 
 #include <AMReX.H>
 #include <AMReX_BLProfiler.H>
+#include <AMReX_GpuDevice.H>
+#include <AMReX_GpuLaunch.H>
 #include <AMReX_REAL.H>
 #include <AMReX_ParmParse.H>
 #include <AMReX_Print.H>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <variant>
 
 
 namespace impactx
 {
+namespace
+{
+    using distribution::ParticleRandomEngine;
+
+    /** Shells of the normalized amplitude for importance sampling of the beam halo
+     *
+     * Shell 0 is the beam core. Shell k > 0 starts at the normalized
+     * amplitude that a fraction halo_ratio^-k of the beam exceeds. Every
+     * shell is sampled directly by the same number of particles, which are
+     * stratified in the fraction of the beam beyond their amplitude. Their
+     * weighting is the number of physical particles of the shell over its
+     * number of particles, so the physical density is preserved.
+     */
+    struct HaloShells
+    {
+        static constexpr int max_shells = 8; ///< maximum number of shells
+
+        int num = 1; ///< number of shells
+        amrex::GpuArray<amrex::Long, max_shells + 1> first{}; ///< index of the first particle of each shell, then the number of particles
+        amrex::GpuArray<double, max_shells + 1> tail{}; ///< fraction of the beam beyond the start of each shell, then 0
+        amrex::GpuArray<amrex::ParticleReal, max_shells> weighting{}; ///< weighting of the particles, per shell
+
+        /** Shell of a particle
+         *
+         * @param i index of the particle in the beam
+         * @return index of the shell
+         */
+        AMREX_GPU_HOST_DEVICE AMREX_FORCE_INLINE
+        int
+        shell (amrex::Long i) const
+        {
+            int k = 0;
+            while (k + 1 < num && i >= first[k + 1]) { ++k; }
+            return k;
+        }
+
+        /** Fraction of the beam beyond the amplitude of a particle
+         *
+         * The particles of a shell are spread evenly over its range, each
+         * at a random position within its own stratum.
+         *
+         * @param i index of the particle in the beam
+         * @param k shell of the particle
+         * @param v random number in (0, 1)
+         * @return fraction of the beam with a larger amplitude, in (0, 1]
+         */
+        AMREX_GPU_HOST_DEVICE AMREX_FORCE_INLINE
+        double
+        tail_of (amrex::Long i, int k, amrex::ParticleReal v) const
+        {
+            double const n = double(first[k + 1] - first[k]);
+            return tail[k] - (tail[k] - tail[k + 1]) * (double(i - first[k]) + double(v)) / n;
+        }
+    };
+
+    /** Divide the particles of a beam into shells of the normalized amplitude
+     *
+     * @param num number of shells
+     * @param ratio ratio of the physical particles between neighboring shells
+     * @param npart number of particles of the beam
+     * @param nphys number of physical particles of the beam
+     * @return shells of the normalized amplitude
+     */
+    HaloShells
+    make_halo_shells (int num, amrex::ParticleReal ratio, amrex::Long npart, amrex::Real nphys)
+    {
+        if (npart < num) {
+            throw std::runtime_error("beam.halo_shells: beam.npart must be at least the number of shells.");
+        }
+
+        HaloShells shells;
+        shells.num = num;
+
+        // the same number of particles per shell
+        amrex::Long const base = npart / num;
+        amrex::Long const rem = npart % num;
+        shells.first[0] = 0;
+        for (int k = 0; k < num; ++k) {
+            shells.first[k + 1] = shells.first[k] + base + (k < rem ? 1 : 0);
+        }
+
+        // shell k starts at the quantile 1 - ratio^-k of the amplitude
+        for (int k = 0; k < num; ++k) {
+            shells.tail[k] = std::pow(double(ratio), -k);
+        }
+        shells.tail[num] = 0.0;
+
+        for (int k = 0; k < num; ++k) {
+            double const n = double(shells.first[k + 1] - shells.first[k]);
+            shells.weighting[k] = amrex::ParticleReal(nphys * (shells.tail[k] - shells.tail[k + 1]) / n);
+        }
+
+        return shells;
+    }
+} // namespace
+
     void
     ImpactX::add_particles (
         amrex::ParticleReal bunch_charge,
         distribution::KnownDistributions distr,
-        int npart
+        amrex::Long npart
     )
     {
         BL_PROFILE("ImpactX::add_particles");
@@ -55,52 +161,168 @@ namespace impactx
             );
         }
 
-        amrex::Vector<amrex::ParticleReal> x, y, t;
-        amrex::Vector<amrex::ParticleReal> px, py, pt;
-        amrex::ParticleReal ix, iy, it, ipx, ipy, ipt;
-        amrex::RandomEngine rng;
+        // particle i of the beam draws the random numbers (seed, i), so the
+        // beam does not depend on the number of MPI ranks or threads
+        amrex::ParmParse pp_beam("beam");
+        amrex::Long seed = 0;
+        pp_beam.queryAdd("seed", seed);
+        if (seed < 0) {
+            throw std::runtime_error("beam.seed must be non-negative but is: " + std::to_string(seed));
+        }
+
+        // pseudo-random or low-discrepancy (quasi-random) samples
+        std::string sampling_str = "random";
+        pp_beam.queryAdd("sampling", sampling_str);
+        distribution::Sampling const sampling = distribution::get_sampling(sampling_str);
+
+        // importance sampling: over-sample the beam halo in shells of the normalized amplitude
+        int halo_shells = 1;
+        pp_beam.queryAdd("halo_shells", halo_shells);
+        if (halo_shells < 1 || halo_shells > HaloShells::max_shells) {
+            throw std::runtime_error("beam.halo_shells must be in [1, " + std::to_string(HaloShells::max_shells) +
+                                     "] but is: " + std::to_string(halo_shells));
+        }
+        amrex::ParticleReal halo_ratio = 10.0;
+        pp_beam.queryAdd("halo_ratio", halo_ratio);
+        if (halo_ratio <= 1.0) {
+            throw std::runtime_error("beam.halo_ratio must be larger than 1 but is: " + std::to_string(halo_ratio));
+        }
+        bool const halo_sampling = halo_shells > 1;
+        using distribution::Gaussian;
+        if (halo_sampling && !std::holds_alternative<Gaussian>(distr)) {
+            throw std::runtime_error("beam.halo_shells > 1 is only supported for beam.distribution = gaussian.");
+        }
+
+        if (sampling == distribution::Sampling::sobol &&
+            static_cast<std::uint64_t>(npart) > distribution::ParticleRandomEngine::max_points_sobol) {
+            throw std::runtime_error("beam.sampling = sobol supports at most 2^32 particles but " +
+                                     std::to_string(npart) + " are requested. Please use beam.sampling = halton.");
+        }
+
+        // the number of physical particles of the beam
+        amrex::Real const nphys = bunch_charge / ablastr::constant::SI::q_e;
+        HaloShells const shells = halo_sampling ?
+            make_halo_shells(halo_shells, halo_ratio, npart, nphys) : HaloShells{};
 
         // Logic: We initialize 1/Nth of particles, independent of their
         // position, per MPI rank. We then measure the distribution's spatial
         // extent, create a grid, resize it to fit the beam, and then
         // redistribute particles so that they reside on the correct MPI rank.
-        int myproc = amrex::ParallelDescriptor::MyProc();
-        int nprocs = amrex::ParallelDescriptor::NProcs();
-        int navg = npart / nprocs;
-        int nleft = npart - navg * nprocs;
-        int npart_this_proc = (myproc < nleft) ? navg+1 : navg;
-        auto const rel_part_this_proc = amrex::ParticleReal(npart_this_proc) /
-                                        amrex::ParticleReal(npart);
-
-        std::visit([&](auto&& distribution){
-            x.reserve(npart_this_proc);
-            y.reserve(npart_this_proc);
-            t.reserve(npart_this_proc);
-            px.reserve(npart_this_proc);
-            py.reserve(npart_this_proc);
-            pt.reserve(npart_this_proc);
-
-            for (amrex::Long i = 0; i < npart_this_proc; ++i) {
-                distribution(ix, iy, it, ipx, ipy, ipt, rng);
-                x.push_back(ix);
-                y.push_back(iy);
-                t.push_back(it);
-                px.push_back(ipx);
-                py.push_back(ipy);
-                pt.push_back(ipt);
+        amrex::Long const myproc = amrex::ParallelDescriptor::MyProc();
+        amrex::Long const nprocs = amrex::ParallelDescriptor::NProcs();
+        amrex::Long const navg = npart / nprocs;
+        amrex::Long const nleft = npart - navg * nprocs;
+        amrex::Long const npart_this_proc = (myproc < nleft) ? navg+1 : navg;
+        // index of the first particle of this MPI rank in the beam
+        amrex::Long const first_this_proc = myproc * navg + std::min(myproc, nleft);
+
+        // the weighting of all particles, or of the particles in each shell
+        int const lev = 0;
+        auto const w0 = amrex::ParticleReal(nphys / amrex::Real(npart));
+        if (halo_sampling) {
+            m_particle_container->SetRealAttributeVarying(RealUniform::w);
+        }
+        int const w_comp = m_particle_container->GetRealAttributeSoAIndex(RealUniform::w);
+
+        using distribution::ParticleRandomEngine;
+        using PType = ImpactXParticleContainer::ParticleType;
+        int const cpu = amrex::ParallelDescriptor::MyProc();
+        auto const seed_dev = static_cast<std::uint64_t>(seed);
+
+        // particles are generated in chunks of bounded size, directly into the particle tiles
+        constexpr amrex::Long chunk_size = amrex::Long(1) << 26;
+        for (amrex::Long chunk_begin = 0; chunk_begin < npart_this_proc; chunk_begin += chunk_size) {
+            amrex::Long const np = std::min(chunk_size, npart_this_proc - chunk_begin);
+            amrex::Long const first = first_this_proc + chunk_begin;
+
+            auto const chunks = m_particle_container->AppendParticles(lev, np, ref.qm_qeeV(), w0);
+
+            // reserve a contiguous block of particle ids
+            amrex::Long const id_begin = PType::NextID();
+            PType::NextID(id_begin + np);
+
+            // the particles only span more than one particle tile if a tile is full
+            for (auto const & chunk : chunks) {
+                auto & particle_tile = *chunk.tile;
+                amrex::Long const chunk_first = first + chunk.first;
+                amrex::Long const chunk_id = id_begin + chunk.first;
+
+                PType * const AMREX_RESTRICT aos_ptr = particle_tile.GetArrayOfStructs()().dataPtr() + chunk.offset;
+                auto & soa_real = particle_tile.GetStructOfArrays().GetRealData();
+                amrex::ParticleReal * const AMREX_RESTRICT part_px = soa_real[RealSoA::px].dataPtr() + chunk.offset;
+                amrex::ParticleReal * const AMREX_RESTRICT part_py = soa_real[RealSoA::py].dataPtr() + chunk.offset;
+                amrex::ParticleReal * const AMREX_RESTRICT part_pt = soa_real[RealSoA::pt].dataPtr() + chunk.offset;
+                amrex::ParticleReal * const AMREX_RESTRICT part_w = halo_sampling ?
+                    soa_real[w_comp].dataPtr() + chunk.offset : nullptr;
+
+                std::visit([&](auto&& distribution){
+                    using Distribution = std::decay_t<decltype(distribution)>;
+                    auto const distr_dev = distribution;
+                    amrex::ParallelFor(chunk.np, [=] AMREX_GPU_DEVICE (int ip) {
+                        // index of the particle in the beam
+                        amrex::Long const i = chunk_first + ip;
+                        ParticleRandomEngine const engine(seed_dev, i, sampling);
+
+                        amrex::ParticleReal u[6] = {0, 0, 0, 0, 0, 0};
+                        if constexpr (std::is_same_v<Distribution, Gaussian>) {
+                            if (halo_sampling) {
+                                int const k = shells.shell(i);
+                                double const tail = shells.tail_of(i, k, Random(engine));
+                                distr_dev.sample_amplitude_tail(u[0], u[1], u[2], u[3], u[4], u[5], tail, engine);
+                                part_w[ip] = shells.weighting[k];
+                            } else {
+                                distr_dev(u[0], u[1], u[2], u[3], u[4], u[5], engine);
+                            }
+                        } else {
+                            distr_dev(u[0], u[1], u[2], u[3], u[4], u[5], engine);
+                        }
+
+                        PType & p = aos_ptr[ip];
+                        p.id() = chunk_id + ip;
+                        p.cpu() = cpu;
+                        p.pos(RealAoS::x) = u[0];
+                        p.pos(RealAoS::y) = u[1];
+                        p.pos(RealAoS::t) = u[2];
+                        part_px[ip] = u[3];
+                        part_py[ip] = u[4];
+                        part_pt[ip] = u[5];
+                    });
+                }, distr);
             }
-        }, distr);
+            amrex::Gpu::streamSynchronize();
+        }
 
-        int const lev = 0;
-        m_particle_container->AddNParticles(lev, x, y, t, px, py, pt,
-                                            ref.qm_qeeV(),
-                                            bunch_charge * rel_part_this_proc);
+        // qm and the weighting are stored per particle if they differ between MPI ranks
+        m_particle_container->SyncRealAttributes();
 
         // Resize the mesh to fit the spatial extent of the beam and then
         // redistribute particles, so they reside on the MPI rank that is
         // responsible for the respective spatial particle position.
         this->ResizeMesh();
-        m_particle_container->Redistribute();
+
+        // with the particle decomposition, particles stay on this MPI rank
+        if (spacecharge::ParticleDecomposition()) {
+            m_particle_container->NumaFirstTouch();
+            return;
+        }
+
+        // cut the mesh into slabs of equal particle count along z
+        this->UpdateSlabDecomposition();
+
+        // keep particles outside of a mesh that is sized after the beam core
+        amrex::Real prob_containment = 1.0;
+        amrex::ParmParse("geometry").query("prob_containment", prob_containment);
+        if (prob_containment < 1.0) {
+            spacecharge::HaloContainer halo = m_particle_container->make_alike();
+            spacecharge::ExtractHaloParticles(*m_particle_container, halo);
+            m_particle_container->Redistribute();
+            spacecharge::RestoreHaloParticles(*m_particle_container, halo);
+        } else {
+            m_particle_container->Redistribute();
+        }
+
+        // place the particles in the NUMA domain of the threads that push them
+        m_particle_container->NumaFirstTouch();
     }
 
     void ImpactX::initBeamDistributionFromInputs ()
@@ -147,7 +369,7 @@ namespace impactx
         m_particle_container->GetRefParticle()
             .set_charge_qe(qe).set_mass_MeV(massE).set_energy_MeV(energy);
 
-        int npart = 1;  // Number of simulation particles
+        amrex::Long npart = 1;  // Number of simulation particles
         pp_dist.get("npart", npart);
 
         std::string unit_type;  // System of units
@@ -11,29 +11,127 @@
 #include "initialization/InitAmrCore.H"
 #include "particles/ImpactXParticleContainer.H"
 #include "particles/distribution/Waterbag.H"
+#include "particles/transformation/CoordinateTransformation.H"
 
 #include <ablastr/warn_manager/WarnManager.H>
 
 #include <AMReX.H>
 #include <AMReX_BLProfiler.H>
+#include <AMReX_DistributionMapping.H>
+#include <AMReX_Extension.H>  // for AMREX_RESTRICT
+#include <AMReX_GpuAtomic.H>
+#include <AMReX_GpuContainers.H>
+#include <AMReX_MultiFab.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_ParallelReduce.H>
+#include <AMReX_ParmParse.H>
+#include <AMReX_Print.H>
 #include <AMReX_REAL.H>
+#include <AMReX_TagBox.H>
 #include <AMReX_Utility.H>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 
 namespace impactx
 {
+namespace
+{
+    /** Cost of each box of a level for load balancing
+     *
+     * The cost is the number of particles in the box plus the number of
+     * nodes of the box, weighted by algo.load_balance_cell_weight, since
+     * the field solve and the charge deposition also scale with the box size.
+     *
+     * @return the cost of all boxes, the same on all MPI ranks
+     */
+    amrex::Vector<amrex::Real>
+    box_costs (ImpactXParticleContainer const & pc, amrex::BoxArray const & ba, int lev)
+    {
+        amrex::Real cell_weight = 0.1;
+        amrex::ParmParse("algo").queryAdd("load_balance_cell_weight", cell_weight);
+
+        amrex::Vector<amrex::Long> const num_particles = pc.NumberOfParticlesInGrid(lev, false, false);
+        amrex::Vector<amrex::Real> costs(ba.size());
+        for (int i = 0; i < static_cast<int>(ba.size()); ++i) {
+            costs[i] = amrex::Real(num_particles[i]) + cell_weight * amrex::Real(ba[i].numPts());
+        }
+        return costs;
+    }
+
+    /** Load balance efficiency of a distribution mapping
+     *
+     * @return the average over the maximum cost of all MPI ranks, 1 is perfect
+     */
+    amrex::Real
+    efficiency (amrex::Vector<amrex::Real> const & costs, amrex::DistributionMapping const & dm)
+    {
+        int const nprocs = amrex::ParallelDescriptor::NProcs();
+        amrex::Vector<amrex::Real> rank_costs(nprocs, 0.0);
+        for (int i = 0; i < static_cast<int>(costs.size()); ++i) {
+            rank_costs[dm[i]] += costs[i];
+        }
+        amrex::Real const max_cost = *std::max_element(rank_costs.begin(), rank_costs.end());
+        amrex::Real const sum_cost = std::accumulate(rank_costs.begin(), rank_costs.end(), amrex::Real(0.0));
+        return max_cost > 0.0 ? sum_cost / (nprocs * max_cost) : amrex::Real(1.0);
+    }
+} // namespace
+
     /** Tag cells for refinement.  TagBoxArray tags is built on level lev grids.
      *
-     * @todo this function is not (yet) implemented.
+     * Cells in the core of the beam are tagged: a cell is refined if the
+     * charge density at one of its nodes is at least amr.refine_threshold
+     * times the maximum charge density on the level. This uses the charge
+     * density of the last deposition.
      */
     void ImpactX::ErrorEst (int lev, amrex::TagBoxArray& tags, amrex::Real time, int ngrow)
     {
-        // todo
-        amrex::ignore_unused(lev, tags, time, ngrow);
+        BL_PROFILE("ImpactX::ErrorEst");
+
+        amrex::ignore_unused(time, ngrow);
+
+        amrex::Real refine_threshold = 0.5;
+        amrex::ParmParse("amr").queryAdd("refine_threshold", refine_threshold);
+        if (refine_threshold <= 0.0 || refine_threshold > 1.0)
+            throw std::runtime_error("amr.refine_threshold must be in (0, 1]");
+
+        amrex::MultiFab const & rho = m_rho.at(lev);
+        amrex::Real const max_rho = rho.norm0();
+        if (max_rho == 0.0) { return; }
+        amrex::Real const rho_threshold = refine_threshold * max_rho;
+
+        auto const tagval = amrex::TagBox::SET;
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#endif
+        for (amrex::MFIter mfi(tags, amrex::TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+            amrex::Box const bx = mfi.tilebox();
+            amrex::Array4<char> const tag_arr = tags.array(mfi);
+            amrex::Array4<amrex::Real const> const rho_arr = rho.const_array(mfi);
+
+            amrex::ParallelFor(bx, [=] AMREX_GPU_DEVICE (int i, int j, int k) noexcept
+            {
+                for (int kk = 0; kk <= 1; ++kk) {
+                    for (int jj = 0; jj <= 1; ++jj) {
+                        for (int ii = 0; ii <= 1; ++ii) {
+                            if (std::abs(rho_arr(i+ii, j+jj, k+kk)) >= rho_threshold) {
+                                tag_arr(i, j, k) = tagval;
+                            }
+                        }
+                    }
+                }
+            });
+        }
     }
 
     /** Make a new level from scratch using provided BoxArray and DistributionMapping.
@@ -45,6 +143,15 @@ namespace impactx
     {
         amrex::ignore_unused(time);
 
+        AllocateLevelData(lev, ba, dm);
+
+        // the Poisson solver uses phi as its initial guess
+        m_phi.at(lev).setVal(0.);
+    }
+
+    void ImpactX::AllocateLevelData (int lev, const amrex::BoxArray& ba,
+                                     const amrex::DistributionMapping& dm)
+    {
         // set human-readable tag for each MultiFab
         auto const tag = [lev]( std::string tagname ) {
             tagname.append("[l=").append(std::to_string(lev)).append("]");
@@ -52,9 +159,7 @@ namespace impactx
         };
 
         // charge (rho) mesh
-        amrex::BoxArray cba = ba;
-        // for MR levels (TODO):
-        //cba.coarsen(refRatio(lev - 1));
+        amrex::BoxArray const & cba = ba;
 
         // staggering and number of charge components in the field
         auto const rho_nodal_flag = amrex::IntVect::TheNodeVector();
@@ -80,7 +185,22 @@ namespace impactx
             lev,
             amrex::MultiFab{amrex::convert(cba, phi_nodal_flag), dm, num_components_phi, num_guards_phi, tag("phi")});
 
+        // first touch: place the pages of each tile in the NUMA domain of the
+        //   OpenMP thread that works on it in the (static) MFIter loops
+        bool numa_aware = false;
+        amrex::ParmParse("impactx").query("numa_aware", numa_aware);
+        if (numa_aware) {
+            m_rho.at(lev).setVal(0.);
+            m_phi.at(lev).setVal(0.);
+        }
+
         // space charge force
+        //   not needed if the gradient of phi is gathered directly
+        std::string field_gather = "force";
+        amrex::ParmParse("algo").queryAdd("field_gather", field_gather);
+        if (field_gather == "potential")
+            return;
+
         std::unordered_map<std::string, amrex::MultiFab> f_comp;
         for (std::string const comp : {"x", "y", "z"})
         {
@@ -95,6 +215,7 @@ namespace impactx
                     tag(str_tag)
                 }
             );
+            if (numa_aware) { f_comp.at(comp).setVal(0.); }
         }
         m_space_charge_field.emplace(lev, std::move(f_comp));
     }
@@ -102,25 +223,47 @@ namespace impactx
     /** Make a new level using provided BoxArray and DistributionMapping and fill
      *  with interpolated coarse level data.
      *
-     * @todo this function is not (yet) implemented.
+     * The charge density and space charge fields are recalculated from the
+     * particles in every slice step. The Poisson solver interpolates the
+     * potential of the coarse level as the initial guess of the new level.
      */
     void ImpactX::MakeNewLevelFromCoarse (int lev, amrex::Real time, const amrex::BoxArray& ba,
                                          const amrex::DistributionMapping& dm)
     {
-        // todo
-        amrex::ignore_unused(lev, time, ba, dm);
+        BL_PROFILE("ImpactX::MakeNewLevelFromCoarse");
+
+        amrex::ignore_unused(time);
+
+        AllocateLevelData(lev, ba, dm);
+
+        m_phi.at(lev).setVal(0.);
     }
 
     /** Remake an existing level using provided BoxArray and DistributionMapping
      *  and fill with existing fine and coarse data.
      *
-     * @todo this function is not (yet) implemented.
+     * The charge density and space charge fields are recalculated from the
+     * particles in every slice step, so only the potential is copied over as
+     * the initial guess of the Poisson solver, if the index space of the
+     * level did not change, e.g., if boxes were load balanced or refined
+     * patches were remade at the same place.
      */
     void ImpactX::RemakeLevel (int lev, amrex::Real time, const amrex::BoxArray& ba,
                               const amrex::DistributionMapping& dm)
     {
-        // todo
-        amrex::ignore_unused(lev, time, ba, dm);
+        BL_PROFILE("ImpactX::RemakeLevel");
+
+        amrex::ignore_unused(time);
+
+        amrex::MultiFab old_phi = std::move(m_phi.at(lev));
+        ClearLevel(lev);
+        AllocateLevelData(lev, ba, dm);
+
+        amrex::MultiFab & phi = m_phi.at(lev);
+        phi.setVal(0.);
+        if (old_phi.boxArray().minimalBox() == phi.boxArray().minimalBox()) {
+            phi.ParallelCopy(old_phi, 0, 0, 1, amrex::IntVect(0), phi.nGrowVect());
+        }
     }
 
     /** Delete level data
@@ -132,12 +275,14 @@ namespace impactx
         m_space_charge_field.erase(lev);
     }
 
-    void ImpactX::ResizeMesh ()
+    int ImpactX::ResizeMesh (bool particles_at_fixed_s)
     {
         BL_PROFILE("ImpactX::ResizeMesh");
 
         // Extract the min and max of the particle positions
-        auto const [x_min, y_min, z_min, x_max, y_max, z_max] = m_particle_container->MinAndMaxPositions();
+        auto const [x_min, y_min, z_min, x_max, y_max, z_max] = particles_at_fixed_s ?
+            transformation::MinAndMaxPositionsFixedT(*m_particle_container) :
+            m_particle_container->MinAndMaxPositions();
 
         // guard for flat beams:
         //   https://github.com/ECP-WarpX/impactx/issues/44
@@ -148,6 +293,9 @@ namespace impactx
         bool dynamic_size = true;
         pp_geometry.query("dynamic_size", dynamic_size);
 
+        // maximum shift of the mesh in cells, -1 if the mesh was set from scratch
+        int mesh_shift_cells = -1;
+
         amrex::RealBox rb;
         if (dynamic_size)
         {
@@ -170,14 +318,80 @@ namespace impactx
             if (frac < 1.0)
                 throw std::runtime_error("geometry.prob_relative must be >= 1.0 (the beam size) on the coarsest level");
 
-            amrex::RealVect const beam_min(x_min, y_min, z_min);
-            amrex::RealVect const beam_max(x_max, y_max, z_max);
+            amrex::Real hysteresis = 0.0;
+            pp_geometry.query("resize_hysteresis", hysteresis);
+            if (hysteresis < 0.0 || hysteresis >= 1.0)
+                throw std::runtime_error("geometry.resize_hysteresis must be in [0, 1)");
+
+            // size the mesh after the beam core: far halo particles outside
+            // of the mesh are not deposited
+            amrex::Real containment = 1.0;
+            pp_geometry.query("prob_containment", containment);
+            if (containment <= 0.0 || containment > 1.0)
+                throw std::runtime_error("geometry.prob_containment must be in (0, 1]");
+
+            amrex::RealVect beam_min(x_min, y_min, z_min);
+            amrex::RealVect beam_max(x_max, y_max, z_max);
+            if (containment < 1.0) {
+                if (particles_at_fixed_s)
+                    throw std::runtime_error("geometry.prob_containment < 1 needs the particles at fixed t");
+                auto const [x_lo, y_lo, z_lo, x_hi, y_hi, z_hi] =
+                    m_particle_container->QuantilePositions(containment);
+                beam_min = amrex::RealVect(x_lo, y_lo, z_lo);
+                beam_max = amrex::RealVect(x_hi, y_hi, z_hi);
+            }
             amrex::RealVect const beam_width(beam_max - beam_min);
 
             amrex::RealVect const beam_padding = beam_width * (frac - 1.0) / 2.0;
             //                           added to the beam extent --^         ^-- box half above/below the beam
-            rb.setLo(beam_min - beam_padding);
-            rb.setHi(beam_max + beam_padding);
+            amrex::RealVect const target_lo = beam_min - beam_padding;
+            amrex::RealVect const target_hi = beam_max + beam_padding;
+            rb.setLo(target_lo);
+            rb.setHi(target_hi);
+
+            // hysteresis: keep the current mesh while the beam keeps at least
+            // (1 - hysteresis) of its padding and the mesh is not larger than
+            // (1 + hysteresis) of its target size; otherwise move its edges
+            // in whole cells of the current mesh
+            if (hysteresis > 0.0)
+            {
+                amrex::Geometry const & gm = Geom(0);
+                amrex::RealBox rb_new;
+                amrex::Real max_shift_cells = 0.0;
+                bool snapped = true;
+                for (int d = 0; d < AMREX_SPACEDIM; ++d) {
+                    amrex::Real const lo_c = gm.ProbLo(d);
+                    amrex::Real const hi_c = gm.ProbHi(d);
+                    amrex::Real const dx_c = gm.CellSize(d);
+                    amrex::Real const width_t = target_hi[d] - target_lo[d];
+                    amrex::Real const min_padding = (1.0 - hysteresis) * beam_padding[d];
+
+                    bool const keep = beam_min[d] - min_padding >= lo_c &&
+                                      beam_max[d] + min_padding <= hi_c &&
+                                      hi_c - lo_c <= (1.0 + hysteresis) * width_t;
+                    amrex::Real lo_new = lo_c;
+                    amrex::Real hi_new = hi_c;
+                    if (!keep) {
+                        lo_new = lo_c + std::floor((target_lo[d] - lo_c) / dx_c) * dx_c;
+                        hi_new = hi_c + std::ceil((target_hi[d] - hi_c) / dx_c) * dx_c;
+                    }
+                    // the current mesh is too coarse for the beam, e.g., on the first call
+                    if (hi_new - lo_new > (1.0 + hysteresis) * width_t) {
+                        snapped = false;
+                        break;
+                    }
+                    rb_new.setLo(d, lo_new);
+                    rb_new.setHi(d, hi_new);
+
+                    amrex::Real const dx_new = (hi_new - lo_new) / gm.Domain().length(d);
+                    max_shift_cells = std::max(max_shift_cells,
+                        std::max(std::abs(lo_new - lo_c), std::abs(hi_new - hi_c)) / dx_new);
+                }
+                if (snapped) {
+                    rb = rb_new;
+                    mesh_shift_cells = static_cast<int>(std::ceil(max_shift_cells));
+                }
+            }
         }
         else
         {
@@ -204,5 +418,292 @@ namespace impactx
             g.ProbDomain(rb);
             amrex::AmrMesh::SetGeometry(lev, g);
         }
+
+        return mesh_shift_cells;
+    }
+
+    bool ImpactX::UpdateRefinedLevels ()
+    {
+        BL_PROFILE("ImpactX::UpdateRefinedLevels");
+
+        if (maxLevel() == 0) { return false; }
+
+        int const old_finest_level = finestLevel();
+        amrex::Vector<amrex::BoxArray> old_ba;
+        for (int lev = 0; lev <= old_finest_level; ++lev) {
+            old_ba.push_back(boxArray(lev));
+        }
+
+        // tag the core of the beam and (re)make all levels above the coarsest
+        regrid(0, 0.0);
+
+        bool changed = finestLevel() != old_finest_level;
+        for (int lev = 1; !changed && lev <= finestLevel(); ++lev) {
+            changed = boxArray(lev) != old_ba[lev];
+        }
+        return changed;
+    }
+
+    bool ImpactX::UpdateGridResolution (bool particles_at_fixed_s)
+    {
+        BL_PROFILE("ImpactX::UpdateGridResolution");
+
+        using namespace amrex::literals;
+
+        amrex::ParmParse pp_amr("amr");
+        bool dynamic_n_cell = false;
+        pp_amr.query("dynamic_n_cell", dynamic_n_cell);
+        if (!dynamic_n_cell) { return false; }
+
+        if (finestLevel() > 0)
+            throw std::runtime_error("amr.dynamic_n_cell is not yet supported with mesh refinement");
+
+        amrex::Real particles_per_cell = 8.0;
+        amrex::Real max_aspect_ratio = 10.0;
+        int max_n_cell = 1024;
+        pp_amr.query("target_particles_per_cell", particles_per_cell);
+        pp_amr.query("max_cell_aspect_ratio", max_aspect_ratio);
+        pp_amr.query("max_n_cell", max_n_cell);
+        if (particles_per_cell <= 0.0)
+            throw std::runtime_error("amr.target_particles_per_cell must be positive");
+        if (max_aspect_ratio < 1.0)
+            throw std::runtime_error("amr.max_cell_aspect_ratio must be >= 1.0");
+
+        auto const [x_mean, x_std, y_mean, y_std, z_mean, z_std] = particles_at_fixed_s ?
+            transformation::MeanAndStdPositionsFixedT(*m_particle_container) :
+            m_particle_container->MeanAndStdPositions();
+        amrex::ignore_unused(x_mean, y_mean, z_mean);
+        amrex::Long const np = m_particle_container->TotalNumberOfParticles(true, false);
+        std::array<amrex::Real, 3> const sigma = {x_std, y_std, z_std};
+        amrex::Real const sigma_max = *std::max_element(sigma.begin(), sigma.end());
+        if (np == 0 || sigma_max <= 0.0_rt) { return false; }
+
+        // the cell sizes follow the beam aspect ratio, limited to max_aspect_ratio
+        std::array<amrex::Real, 3> sigma_eff;
+        amrex::Real ratio_product = 1.0_rt;
+        for (int d = 0; d < 3; ++d) {
+            sigma_eff[d] = std::max(sigma[d], sigma_max / max_aspect_ratio);
+            ratio_product *= sigma[d] / sigma_eff[d];
+        }
+        // with cell sizes dx_d = s * sigma_eff_d, the +/-2 sigma box of the
+        // beam holds np / prod(4 sigma_d / dx_d) = particles_per_cell
+        amrex::Real const s = std::cbrt(64.0_rt * ratio_product * particles_per_cell / amrex::Real(np));
+
+        amrex::Geometry const & gm = Geom(0);
+        amrex::IntVect const old_n_cell = gm.Domain().length();
+        amrex::IntVect n_cell;
+        bool significant_change = false;
+        for (int d = 0; d < AMREX_SPACEDIM; ++d) {
+            int const bf = blockingFactor(0)[d];
+            int const n_max = std::max(bf, max_n_cell / bf * bf);
+            int n = static_cast<int>(std::ceil(gm.ProbLength(d) / (s * sigma_eff[d])));
+            n = std::clamp((n + bf - 1) / bf * bf, bf, n_max);
+            n_cell[d] = n;
+
+            // avoid regridding back and forth for small changes
+            significant_change = significant_change ||
+                std::abs(n - old_n_cell[d]) > std::max(bf, old_n_cell[d] / 10);
+        }
+        if (!significant_change) { return false; }
+
+        // new index space on the same physical domain
+        amrex::Box const domain(amrex::IntVect(0), n_cell - amrex::IntVect(1));
+        amrex::Array<int, AMREX_SPACEDIM> const is_periodic{AMREX_D_DECL(0, 0, 0)};
+        amrex::Geometry const new_geom(domain, gm.ProbDomain(), gm.Coord(), is_periodic);
+        amrex::AmrMesh::SetGeometry(0, new_geom);
+
+        amrex::BoxArray ba(domain);
+        ba.maxSize(maxGridSize(0));
+        amrex::DistributionMapping const dm = MakeDistributionMap(0, ba);
+
+        RemakeLevel(0, 0.0, ba, dm);
+        SetBoxArray(0, ba);
+        SetDistributionMap(0, dm);
+
+        // updating amr.n_cell for consistency
+        amrex::Vector<int> const n_cell_v(n_cell.begin(), n_cell.end());
+        pp_amr.addarr("n_cell", n_cell_v);
+
+        amrex::Print() << " Regridded to n_cell=" << n_cell << "\n";
+
+        return true;
+    }
+
+    bool ImpactX::UpdateSlabDecomposition (bool particles_at_fixed_s)
+    {
+        BL_PROFILE("ImpactX::UpdateSlabDecomposition");
+
+        std::string domain_decomposition = "boxes";
+        amrex::ParmParse pp_amr("amr");
+        pp_amr.queryAdd("domain_decomposition", domain_decomposition);
+        if (domain_decomposition != "boxes" && domain_decomposition != "z_slabs")
+            throw std::runtime_error("amr.domain_decomposition must be boxes or z_slabs but is: " + domain_decomposition);
+        if (domain_decomposition != "z_slabs") { return false; }
+
+        amrex::Real ratio_threshold = 1.1;
+        pp_amr.queryAdd("z_slabs_ratio_threshold", ratio_threshold);
+        if (ratio_threshold < 1.0)
+            throw std::runtime_error("amr.z_slabs_ratio_threshold must be >= 1.0");
+
+        // particles at fixed s are only used on a single MPI process
+        int const nprocs = amrex::ParallelDescriptor::NProcs();
+        if (particles_at_fixed_s || nprocs == 1) { return false; }
+
+        // parallel histogram of the longitudinal cell index of all particles, weighted by their weighting
+        amrex::Geometry const & gm = Geom(0);
+        amrex::Box const & domain = gm.Domain();
+        int const nz = domain.length(2);
+        int const k_lo = domain.smallEnd(2);
+        amrex::Real const z_lo = gm.ProbLo(2);
+        amrex::Real const inv_dz = gm.InvCellSize(2);
+
+        amrex::Gpu::DeviceVector<amrex::Real> histogram_d(nz, 0.0);
+        amrex::Real * const AMREX_RESTRICT histogram_ptr = histogram_d.dataPtr();
+        for (int lev = 0; lev <= finestLevel(); ++lev) {
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#endif
+            for (ParIter pti(*m_particle_container, lev); pti.isValid(); ++pti) {
+                int const np = pti.numParticles();
+                using PType = ImpactXParticleContainer::ParticleType;
+                PType const * const AMREX_RESTRICT aos_ptr = pti.GetArrayOfStructs()().dataPtr();
+                auto const ptd = pti.GetParticleTile().getConstParticleTileData();
+                RealUniformAccessor const part_w = m_particle_container->GetRealAttribute(RealUniform::w);
+
+                amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) {
+                    int const k = static_cast<int>(std::floor((aos_ptr[i].pos(RealAoS::z) - z_lo) * inv_dz));
+                    amrex::HostDevice::Atomic::Add(&histogram_ptr[std::clamp(k, 0, nz - 1)], amrex::Real(part_w(ptd, i)));
+                });
+            }
+        }
+        std::vector<amrex::Real> histogram(nz);
+        amrex::Gpu::copy(amrex::Gpu::deviceToHost, histogram_d.begin(), histogram_d.end(), histogram.begin());
+        amrex::ParallelAllReduce::Sum(histogram.data(), nz, amrex::ParallelDescriptor::Communicator());
+
+        std::vector<amrex::Real> cumulative(nz + 1, 0.0);
+        std::partial_sum(histogram.begin(), histogram.end(), cumulative.begin() + 1);
+        amrex::Real const total = cumulative.back();
+        if (total <= 0.0) { return false; }
+
+        // slabs of equal weighting, one per MPI process,
+        // with a length that is a multiple of the blocking factor
+        int const bf = blockingFactor(0)[2];
+        int const num_slabs = std::max(1, std::min(nprocs, nz / bf));
+        std::vector<int> cuts{0};
+        for (int s = 1; s < num_slabs; ++s) {
+            amrex::Real const target = total * s / num_slabs;
+            int const k = static_cast<int>(std::lower_bound(cumulative.begin(), cumulative.end(), target) - cumulative.begin());
+            int const k_bf = std::clamp((k + bf / 2) / bf * bf, cuts.back() + bf, nz - (num_slabs - s) * bf);
+            cuts.push_back(k_bf);
+        }
+        cuts.push_back(nz);
+
+        // weighting of the most loaded slab
+        auto const max_slab_weight = [&cumulative](std::vector<int> const & slab_cuts) {
+            amrex::Real max_count = 0.0;
+            for (std::size_t s = 0; s + 1 < slab_cuts.size(); ++s) {
+                max_count = std::max(max_count, cumulative[slab_cuts[s + 1]] - cumulative[slab_cuts[s]]);
+            }
+            return max_count;
+        };
+
+        // only change the boxes if the current slabs are noticeably less balanced
+        //   the current boxes are slabs if their longitudinal ranges do not overlap
+        //   and all boxes of slab s are on MPI process s
+        amrex::BoxArray const & old_ba = boxArray(0);
+        std::set<std::pair<int, int>> old_ranges;
+        for (int i = 0; i < static_cast<int>(old_ba.size()); ++i) {
+            old_ranges.insert({old_ba[i].smallEnd(2) - k_lo, old_ba[i].bigEnd(2) - k_lo + 1});
+        }
+        std::vector<int> old_cuts{0};
+        bool old_is_slabs = true;
+        for (auto const & [lo, hi] : old_ranges) {
+            old_is_slabs = old_is_slabs && lo == old_cuts.back();
+            old_cuts.push_back(hi);
+        }
+        amrex::DistributionMapping const & old_dm = DistributionMap(0);
+        for (int i = 0; i < static_cast<int>(old_ba.size()) && old_is_slabs; ++i) {
+            int const k = old_ba[i].smallEnd(2) - k_lo;
+            int const slab = static_cast<int>(std::upper_bound(old_cuts.begin(), old_cuts.end(), k) - old_cuts.begin()) - 1;
+            old_is_slabs = old_dm[i] == slab;
+        }
+        if (old_is_slabs && max_slab_weight(old_cuts) <= ratio_threshold * max_slab_weight(cuts)) { return false; }
+
+        amrex::BoxList slabs;
+        for (std::size_t s = 0; s + 1 < cuts.size(); ++s) {
+            amrex::Box slab = domain;
+            slab.setSmall(2, k_lo + cuts[s]);
+            slab.setBig(2, k_lo + cuts[s + 1] - 1);
+            slabs.push_back(slab);
+        }
+        amrex::BoxArray ba(std::move(slabs));
+        amrex::IntVect max_size = maxGridSize(0);
+        max_size[2] = nz;
+        ba.maxSize(max_size);
+
+        // all boxes of slab s are on MPI process s
+        amrex::Vector<int> pmap(ba.size());
+        for (int i = 0; i < static_cast<int>(ba.size()); ++i) {
+            int const k = ba[i].smallEnd(2) - k_lo;
+            pmap[i] = static_cast<int>(std::upper_bound(cuts.begin(), cuts.end(), k) - cuts.begin()) - 1;
+        }
+        amrex::DistributionMapping const dm(std::move(pmap));
+
+        RemakeLevel(0, 0.0, ba, dm);
+        SetBoxArray(0, ba);
+        SetDistributionMap(0, dm);
+
+        return true;
+    }
+
+    amrex::Real ImpactX::LoadBalanceEfficiency (int lev) const
+    {
+        BL_PROFILE("ImpactX::LoadBalanceEfficiency");
+
+        amrex::Vector<amrex::Real> const costs = box_costs(*m_particle_container, boxArray(lev), lev);
+        return efficiency(costs, DistributionMap(lev));
+    }
+
+    bool ImpactX::LoadBalance ()
+    {
+        BL_PROFILE("ImpactX::LoadBalance");
+
+        amrex::ParmParse pp_algo("algo");
+        std::string strategy = "knapsack";
+        amrex::Real efficiency_ratio_threshold = 1.1;
+        pp_algo.queryAdd("load_balance_strategy", strategy);
+        pp_algo.queryAdd("load_balance_efficiency_ratio_threshold", efficiency_ratio_threshold);
+        if (strategy != "knapsack" && strategy != "sfc")
+            throw std::runtime_error("algo.load_balance_strategy must be knapsack or sfc but is: " + strategy);
+
+        if (amrex::ParallelDescriptor::NProcs() == 1) { return false; }
+
+        // slabs are balanced by moving their cuts, see UpdateSlabDecomposition
+        std::string domain_decomposition = "boxes";
+        amrex::ParmParse("amr").queryAdd("domain_decomposition", domain_decomposition);
+        int const lev_min = domain_decomposition == "z_slabs" ? 1 : 0;
+
+        bool changed = false;
+        for (int lev = lev_min; lev <= finestLevel(); ++lev) {
+            amrex::BoxArray const & ba = boxArray(lev);
+            amrex::Vector<amrex::Real> const costs = box_costs(*m_particle_container, ba, lev);
+            amrex::Real const current_efficiency = efficiency(costs, DistributionMap(lev));
+
+            amrex::Real proposed_efficiency = 0.0;
+            amrex::DistributionMapping const dm = strategy == "sfc" ?
+                amrex::DistributionMapping::makeSFC(costs, ba, proposed_efficiency) :
+                amrex::DistributionMapping::makeKnapSack(costs, proposed_efficiency);
+
+            // only migrate boxes if this pays off
+            if (proposed_efficiency <= efficiency_ratio_threshold * current_efficiency) { continue; }
+
+            RemakeLevel(lev, 0.0, ba, dm);
+            SetDistributionMap(lev, dm);
+            changed = true;
+
+            amrex::Print() << " Load balanced level " << lev << ": efficiency "
+                           << current_efficiency << " -> " << proposed_efficiency << "\n";
+        }
+        return changed;
     }
 } // namespace impactx
@@ -8,24 +8,304 @@
  * License: BSD-3-Clause-LBNL
  */
 #include "ImpactXParticleContainer.H"
+#include "ShapeFactors.H"
 
+#include <ablastr/coarsen/average.H>
 #include <ablastr/particles/DepositCharge.H>
+#include <ablastr/utils/Communication.H>
+#include <ablastr/warn_manager/WarnManager.H>
 
 #include <AMReX.H>
 #include <AMReX_AmrParGDB.H>
+#include <AMReX_BLProfiler.H>
+#include <AMReX_Extension.H>  // for AMREX_PRAGMA_SIMD, AMREX_RESTRICT
+#include <AMReX_FArrayBox.H>
+#include <AMReX_Geometry.H>
+#include <AMReX_GpuLaunch.H>
+#include <AMReX_Math.H>
+#include <AMReX_MultiFab.H>
 #include <AMReX_ParallelDescriptor.H>
+#include <AMReX_ParmParse.H>
 #include <AMReX_ParticleTile.H>
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 
 namespace impactx
 {
+namespace
+{
+#ifndef AMREX_USE_GPU
+    /** Per-thread scratch memory of the binned charge deposition */
+    struct BinnedDepositionBuffers
+    {
+        std::vector<int> cell_x, cell_y, cell_z;
+        std::vector<amrex::Real> shape_x, shape_y, shape_z;
+    };
+
+    /** Charge deposition of one particle tile on CPU, for particles sorted by cell
+     *
+     * Consecutive particles in the same cell share the first node of their
+     * deposition stencil. For each such run of particles, the shape factors
+     * are computed in SIMD lanes and the contribution to each node of the
+     * stencil is accumulated with a SIMD reduction over the run, before it is
+     * added once to the mesh. This avoids write conflicts between SIMD lanes
+     * and scattered memory access. The result is independent of the particle
+     * order, but particles should be sorted by cell for performance.
+     *
+     * @tparam depos_order the order of the particle shape
+     * @param pti particle tile iterator
+     * @param charge charge of the particle species in C
+     * @param part_w weighting of the particles, see ImpactXParticleContainer::GetRealAttribute
+     * @param local_rho_fab tile-local charge density to deposit to, nodal
+     * @param xyzmin physical lower corner of local_rho_fab
+     * @param dx cell size
+     * @param buf per-thread scratch memory
+     */
+    template <int depos_order>
+    void
+    deposit_charge_binned (
+        ParIter & pti,
+        amrex::ParticleReal charge,
+        RealUniformAccessor part_w,
+        amrex::FArrayBox & local_rho_fab,
+        std::array<amrex::Real, 3> const & xyzmin,
+        std::array<amrex::Real, 3> const & dx,
+        BinnedDepositionBuffers & buf
+    )
+    {
+        using namespace amrex::literals;
+
+        // the first stencil node per cell; for even orders, particles in a
+        // cell can start one node apart, so the stencil is widened by one
+        constexpr int half = depos_order / 2;
+        constexpr int width = depos_order % 2 == 0 ? depos_order + 2 : depos_order + 1;
+
+        int const np = pti.numParticles();
+        if (np == 0) { return; }
+
+        using PType = ImpactXParticleContainer::ParticleType;
+        PType const * const AMREX_RESTRICT aos_ptr = pti.GetArrayOfStructs()().dataPtr();
+        auto const ptd = pti.GetParticleTile().getConstParticleTileData();
+
+        amrex::Real const dxi = 1.0_rt / dx[0];
+        amrex::Real const dyi = 1.0_rt / dx[1];
+        amrex::Real const dzi = 1.0_rt / dx[2];
+        amrex::Real const invvol = dxi * dyi * dzi;
+        amrex::Real const xmin = xyzmin[0];
+        amrex::Real const ymin = xyzmin[1];
+        amrex::Real const zmin = xyzmin[2];
+
+        auto const rho_arr = local_rho_fab.array();
+        amrex::Dim3 const lo = amrex::lbound(local_rho_fab.box());
+
+        // cell of each particle, relative to the lower corner of the tile
+        buf.cell_x.resize(np);
+        buf.cell_y.resize(np);
+        buf.cell_z.resize(np);
+        int * const AMREX_RESTRICT cx = buf.cell_x.data();
+        int * const AMREX_RESTRICT cy = buf.cell_y.data();
+        int * const AMREX_RESTRICT cz = buf.cell_z.data();
+AMREX_PRAGMA_SIMD
+        for (int i = 0; i < np; ++i) {
+            cx[i] = static_cast<int>(std::floor((aos_ptr[i].pos(0) - xmin) * dxi));
+            cy[i] = static_cast<int>(std::floor((aos_ptr[i].pos(1) - ymin) * dyi));
+            cz[i] = static_cast<int>(std::floor((aos_ptr[i].pos(2) - zmin) * dzi));
+        }
+
+        int b = 0;
+        while (b < np) {
+            // run of particles in the same cell
+            int e = b + 1;
+            while (e < np && cx[e] == cx[b] && cy[e] == cy[b] && cz[e] == cz[b]) { ++e; }
+            int const n = e - b;
+
+            buf.shape_x.resize(std::max<std::size_t>(buf.shape_x.size(), width * n));
+            buf.shape_y.resize(std::max<std::size_t>(buf.shape_y.size(), width * n));
+            buf.shape_z.resize(std::max<std::size_t>(buf.shape_z.size(), width * n));
+            amrex::Real * const AMREX_RESTRICT shx = buf.shape_x.data();
+            amrex::Real * const AMREX_RESTRICT shy = buf.shape_y.data();
+            amrex::Real * const AMREX_RESTRICT shz = buf.shape_z.data();
+
+            int const base_x = cx[b] - half;
+            int const base_y = cy[b] - half;
+            int const base_z = cz[b] - half;
+
+            // shape factors on the widened stencil, stored per node as [node * n + particle]
+AMREX_PRAGMA_SIMD
+            for (int q = 0; q < n; ++q) {
+                int const i = b + q;
+                amrex::Real const wq = charge * part_w(ptd, i) * invvol;
+
+                amrex::Real sx[depos_order + 1];
+                amrex::Real sy[depos_order + 1];
+                amrex::Real sz[depos_order + 1];
+                int const ox = ShapeFactor<depos_order>{}(sx, (aos_ptr[i].pos(0) - xmin) * dxi) - base_x;
+                int const oy = ShapeFactor<depos_order>{}(sy, (aos_ptr[i].pos(1) - ymin) * dyi) - base_y;
+                int const oz = ShapeFactor<depos_order>{}(sz, (aos_ptr[i].pos(2) - zmin) * dzi) - base_z;
+
+                for (int k = 0; k < width; ++k) {
+                    int const kx = k - ox;
+                    int const ky = k - oy;
+                    int const kz = k - oz;
+                    shx[k * n + q] = (kx >= 0 && kx <= depos_order) ? sx[kx] * wq : 0.0_rt;
+                    shy[k * n + q] = (ky >= 0 && ky <= depos_order) ? sy[ky] : 0.0_rt;
+                    shz[k * n + q] = (kz >= 0 && kz <= depos_order) ? sz[kz] : 0.0_rt;
+                }
+            }
+
+            // accumulate per stencil node over the run, then add once
+            for (int iz = 0; iz < width; ++iz) {
+                amrex::Real const * const AMREX_RESTRICT szp = shz + iz * n;
+                for (int iy = 0; iy < width; ++iy) {
+                    amrex::Real const * const AMREX_RESTRICT syp = shy + iy * n;
+                    for (int ix = 0; ix < width; ++ix) {
+                        amrex::Real const * const AMREX_RESTRICT sxp = shx + ix * n;
+                        amrex::Real sum = 0.0_rt;
+#ifdef AMREX_USE_OMP
+#pragma omp simd reduction(+:sum)
+#endif
+                        for (int q = 0; q < n; ++q) {
+                            sum += sxp[q] * syp[q] * szp[q];
+                        }
+                        rho_arr(lo.x + base_x + ix, lo.y + base_y + iy, lo.z + base_z + iz) += sum;
+                    }
+                }
+            }
+
+            b = e;
+        }
+    }
+#endif
+
+    /** Add the charge in the guard cells of a fine level outside of its patch to the coarse level
+     *
+     * Particles close to the edge of a refined patch deposit part of their
+     * charge in guard cells of the fine level that are not covered by any
+     * fine box. This charge is not part of the fine charge density that is
+     * averaged down, so it is restricted to the coarse nodes with the
+     * transpose of the linear interpolation, which conserves the charge,
+     * and added to the coarse level. This is the role of the coarse buffer
+     * in WarpX.
+     *
+     * @param rho_crse charge density of the coarse level, guard cells are summed already
+     * @param rho_fine charge density of the fine level, before its guard cells are reset
+     * @param ref_ratio refinement ratio between the levels
+     * @param mixed_precision_fields communicate in single precision
+     * @param geom_crse geometry of the coarse level
+     */
+    void
+    AddFineChargeOutsidePatch (
+        amrex::MultiFab & rho_crse,
+        amrex::MultiFab const & rho_fine,
+        amrex::IntVect const & ref_ratio,
+        bool mixed_precision_fields,
+        amrex::Geometry const & geom_crse
+    )
+    {
+        BL_PROFILE("impactx::AddFineChargeOutsidePatch");
+
+        amrex::BoxArray const & fine_ba = rho_fine.boxArray();
+        amrex::IntVect const ng_fine = rho_fine.nGrowVect();
+
+        // charge in the fine guard cells that are not covered by a fine box
+        amrex::MultiFab outside(fine_ba, rho_fine.DistributionMap(), rho_fine.nComp(), ng_fine);
+        amrex::MultiFab::Copy(outside, rho_fine, 0, 0, rho_fine.nComp(), ng_fine);
+        for (amrex::MFIter mfi(outside); mfi.isValid(); ++mfi) {
+            for (auto const & isect : fine_ba.intersections(mfi.fabbox())) {
+                outside[mfi].setVal<amrex::RunOn::Device>(0.0, isect.second, 0, outside.nComp());
+            }
+        }
+
+        // restrict to the coarse nodes under each fine box and its guard cells
+        amrex::BoxArray coarsened_fine_ba = fine_ba;
+        coarsened_fine_ba.coarsen(ref_ratio);
+        amrex::IntVect ng_crse;
+        for (int d = 0; d < AMREX_SPACEDIM; ++d) {
+            ng_crse[d] = (ng_fine[d] + ref_ratio[d] - 1) / ref_ratio[d] + 1;
+        }
+        amrex::MultiFab outside_crse(coarsened_fine_ba, rho_fine.DistributionMap(), rho_fine.nComp(), ng_crse);
+        outside_crse.setVal(0.);
+
+        amrex::Real const inv_ratio_volume = 1.0 / amrex::Real(ref_ratio[0] * ref_ratio[1] * ref_ratio[2]);
+        amrex::GpuArray<int, 3> const r{ref_ratio[0], ref_ratio[1], ref_ratio[2]};
+
+        for (amrex::MFIter mfi(outside_crse); mfi.isValid(); ++mfi) {
+            amrex::Box const fine_box = outside[mfi].box();
+            auto const fine_lo = amrex::lbound(fine_box);
+            auto const fine_hi = amrex::ubound(fine_box);
+            amrex::Array4<amrex::Real const> const fine_arr = outside.const_array(mfi);
+            amrex::Array4<amrex::Real> const crse_arr = outside_crse.array(mfi);
+
+            amrex::ParallelFor(outside_crse[mfi].box(), [=] AMREX_GPU_DEVICE (int i, int j, int k) noexcept
+            {
+                amrex::Real sum = 0.0;
+                for (int kk = amrex::max(k * r[2] - r[2] + 1, fine_lo.z); kk <= amrex::min(k * r[2] + r[2] - 1, fine_hi.z); ++kk) {
+                    amrex::Real const wz = 1.0 - amrex::Math::abs(kk - k * r[2]) / amrex::Real(r[2]);
+                    for (int jj = amrex::max(j * r[1] - r[1] + 1, fine_lo.y); jj <= amrex::min(j * r[1] + r[1] - 1, fine_hi.y); ++jj) {
+                        amrex::Real const wy = 1.0 - amrex::Math::abs(jj - j * r[1]) / amrex::Real(r[1]);
+                        for (int ii = amrex::max(i * r[0] - r[0] + 1, fine_lo.x); ii <= amrex::min(i * r[0] + r[0] - 1, fine_hi.x); ++ii) {
+                            amrex::Real const wx = 1.0 - amrex::Math::abs(ii - i * r[0]) / amrex::Real(r[0]);
+                            sum += wx * wy * wz * fine_arr(ii, jj, kk);
+                        }
+                    }
+                }
+                crse_arr(i, j, k) = sum * inv_ratio_volume;
+            });
+        }
+
+        // the guard cells of the coarsened fine boxes hold the restricted charge
+        ablastr::utils::communication::ParallelAdd(
+            rho_crse, outside_crse, 0, 0, rho_crse.nComp(),
+            ng_crse, amrex::IntVect(0),
+            mixed_precision_fields, geom_crse.periodicity());
+    }
+} // namespace
+
     void
     ImpactXParticleContainer::DepositCharge (
         std::unordered_map<int, amrex::MultiFab> & rho,
-        amrex::Vector<amrex::IntVect> const & ref_ratio)
+        amrex::Vector<amrex::IntVect> const & ref_ratio,
+        bool mixed_precision_fields,
+        bool sorted_periodically)
     {
+        BL_PROFILE("ImpactXParticleContainer::DepositCharge");
+
+        // deposition algorithm
+        amrex::ParmParse pp_algo("algo");
+        std::string charge_deposition = "standard";
+        pp_algo.queryAdd("charge_deposition", charge_deposition);
+        if (charge_deposition != "standard" && charge_deposition != "binned")
+            throw std::runtime_error("algo.charge_deposition must be standard or binned but is: " + charge_deposition);
+        bool binned = charge_deposition == "binned";
+#ifdef AMREX_USE_GPU
+        if (binned) {
+            ablastr::warn_manager::WMRecordWarning(
+                "ImpactXParticleContainer::DepositCharge",
+                "algo.charge_deposition = binned is only implemented for CPUs. "
+                "Using the standard charge deposition.",
+                ablastr::warn_manager::WarnPriority::low
+            );
+            binned = false;
+        }
+#endif
+
+        // the binned deposition is fastest for particles sorted by cell
+        //   the cell and morton orders of algo.sort_interval both keep the particles of a cell together
+        if (binned && !sorted_periodically) {
+            BL_PROFILE("ImpactXParticleContainer::DepositCharge::SortParticlesByBin");
+            this->SortParticlesByBin(amrex::IntVect(1));
+        }
+
+        // the weighting of the container if it is the same for all particles, otherwise per particle
+        RealUniformAccessor const part_w = this->GetRealAttribute(RealUniform::w);
+        int const w_comp = this->GetRealAttributeSoAIndex(RealUniform::w);
+
         // loop over refinement levels
         int const nLevel = this->finestLevel();
         for (int lev = 0; lev <= nLevel; ++lev) {
@@ -42,13 +322,13 @@ namespace impactx
 #endif
             {
                 amrex::FArrayBox local_rho_fab;
+                RealVector uniform_wp;
+#ifndef AMREX_USE_GPU
+                BinnedDepositionBuffers binned_buffers;
+#endif
 
                 using ParIt = ImpactXParticleContainer::iterator;
                 for (ParIt pti(*this, lev); pti.isValid(); ++pti) {
-                    // preparing access to particle data: SoA of Reals
-                    auto & AMREX_RESTRICT soa_real = pti.GetStructOfArrays().GetRealData();
-                    // after https://github.com/ECP-WarpX/WarpX/pull/2838 add const:
-                    auto const wp = soa_real[RealSoA::w];
                     int const * const AMREX_RESTRICT ion_lev = nullptr;
 
                     // physical lower corner of the current box
@@ -59,12 +339,8 @@ namespace impactx
                     amrex::Real const * const AMREX_RESTRICT xyzmin_ptr = grid_box.lo();
                     std::array<amrex::Real, 3> const xyzmin = {xyzmin_ptr[0], xyzmin_ptr[1], xyzmin_ptr[2]};
 
-                    // mesh-refinement: for when we do not deposit on the same level
-                    // note: would need to communicate the deposited-to boxes afterwards
-                    //int const depos_lev = lev;
-                    // mesh refinement ratio between lev and depos_lev
-                    //auto const rel_ref_ratio = ref_ratio.at(depos_lev) / ref_ratio.at(lev);
-                    amrex::ignore_unused(ref_ratio);
+                    // mesh-refinement: particles deposit on the level they are stored on,
+                    // the charge of finer levels is added to coarser levels below
 
                     // in SI [C]
                     amrex::ParticleReal const charge = m_refpart.charge;
@@ -75,6 +351,43 @@ namespace impactx
                     // RZ modes (unused)
                     int const n_rz_azimuthal_modes = 0;
 
+#ifndef AMREX_USE_GPU
+                    if (binned) {
+                        amrex::Box const tb = amrex::convert(tilebox, amrex::IntVect::TheNodeVector());
+                        local_rho_fab.resize(tb);
+                        local_rho_fab.setVal<amrex::RunOn::Host>(0.0);
+
+                        switch (m_particle_shape.value()) {
+                            case 1:
+                                deposit_charge_binned<1>(pti, charge, part_w, local_rho_fab, xyzmin, dx, binned_buffers);
+                                break;
+                            case 2:
+                                deposit_charge_binned<2>(pti, charge, part_w, local_rho_fab, xyzmin, dx, binned_buffers);
+                                break;
+                            case 3:
+                                deposit_charge_binned<3>(pti, charge, part_w, local_rho_fab, xyzmin, dx, binned_buffers);
+                                break;
+                            default:
+                                throw std::runtime_error("DepositCharge: particle shape must be 1, 2 or 3");
+                        }
+
+                        rho_at_level[pti].atomicAdd<amrex::RunOn::Host>(local_rho_fab, tb, tb, 0, 0, 1);
+                        continue;
+                    }
+#endif
+                    amrex::ignore_unused(binned);
+
+                    // the deposition of ABLASTR reads the weighting per particle:
+                    // expand a uniform weighting into a buffer for this tile
+                    if (w_comp < 0) {
+                        int const np = pti.numParticles();
+                        uniform_wp.resize(np);
+                        amrex::ParticleReal * const AMREX_RESTRICT uniform_wp_ptr = uniform_wp.dataPtr();
+                        amrex::ParticleReal const w = part_w.m_value;
+                        amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) { uniform_wp_ptr[i] = w; });
+                    }
+                    RealVector const & wp = w_comp < 0 ? uniform_wp : pti.GetStructOfArrays().GetRealData(w_comp);
+
                     ablastr::particles::deposit_charge<ImpactXParticleContainer>
                             (pti, wp, charge, ion_lev, &rho_at_level,
                              local_rho_fab,
@@ -84,7 +397,9 @@ namespace impactx
             }
 
             // start async charge communication for this level
-            rho_at_level.SumBoundary_nowait();
+            if (!mixed_precision_fields) {
+                rho_at_level.SumBoundary_nowait();
+            }
             //int const comp = 0;
             //rho_at_level.SumBoundary_nowait(comp, comp, rho_at_level.nGrowVect());
         }
@@ -92,8 +407,39 @@ namespace impactx
         // finalize communication
         for (int lev = 0; lev <= nLevel; ++lev)
         {
+            BL_PROFILE("ImpactXParticleContainer::DepositCharge::SumBoundary");
+            amrex::MultiFab & rho_at_level = rho.at(lev);
+            if (mixed_precision_fields) {
+                ablastr::utils::communication::SumBoundary(
+                    rho_at_level, 0, rho_at_level.nComp(), rho_at_level.nGrowVect(),
+                    true, this->Geom(lev).periodicity());
+            } else {
+                rho_at_level.SumBoundary_finish();
+            }
+        }
+
+        // mesh-refinement: add the charge of the particles on finer levels
+        //   Particles are stored on the finest level that covers them. The
+        //   Poisson solve on a coarse level needs the charge of all particles,
+        //   thus we average the fine charge density down, from fine to coarse.
+        for (int lev = nLevel - 1; lev >= 0; --lev)
+        {
+            amrex::MultiFab const & rho_fine = rho.at(lev + 1);
+            amrex::BoxArray coarsened_fine_ba = rho_fine.boxArray();
+            coarsened_fine_ba.coarsen(ref_ratio.at(lev));
+            amrex::MultiFab coarsened_fine_data(coarsened_fine_ba, rho_fine.DistributionMap(), rho_fine.nComp(), 0);
+            coarsened_fine_data.setVal(0.);
+            ablastr::coarsen::average::Coarsen(coarsened_fine_data, rho_fine, ref_ratio.at(lev));
+
             amrex::MultiFab & rho_at_level = rho.at(lev);
-            rho_at_level.SumBoundary_finish();
+            ablastr::utils::communication::ParallelAdd(
+                rho_at_level, coarsened_fine_data, 0, 0, rho_at_level.nComp(),
+                amrex::IntVect(0), amrex::IntVect(0),
+                mixed_precision_fields, this->Geom(lev).periodicity());
+
+            // the fine charge outside of the refined patch
+            AddFineChargeOutsidePatch(rho_at_level, rho_fine, ref_ratio.at(lev),
+                                      mixed_precision_fields, this->Geom(lev));
         }
     }
 } // namespace impactx
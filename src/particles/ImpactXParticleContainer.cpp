@@ -8,6 +8,7 @@
  * License: BSD-3-Clause-LBNL
  */
 #include "ImpactXParticleContainer.H"
+#include "ParallelForParticles.H"
 
 #include <ablastr/constant.H>
 #include <ablastr/particles/ParticleMoments.H>
@@ -15,22 +16,65 @@
 #include <AMReX.H>
 #include <AMReX_AmrCore.H>
 #include <AMReX_AmrParGDB.H>
+#include <AMReX_GpuAtomic.H>
+#include <AMReX_GpuContainers.H>
 #include <AMReX_ParallelDescriptor.H>
+#include <AMReX_ParallelReduce.H>
+#include <AMReX_ParticleReduce.H>
 #include <AMReX_ParmParse.H>
 #include <AMReX_ParticleTile.H>
+#include <AMReX_Reduce.H>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
 #include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
 
 
 namespace impactx
 {
     bool do_omp_dynamic () {
         bool do_dynamic = true;
+        bool numa_aware = false;
         amrex::ParmParse pp_impactx("impactx");
         pp_impactx.query("do_dynamic_scheduling", do_dynamic);
-        return do_dynamic;
+        pp_impactx.query("numa_aware", numa_aware);
+        // a stable tile-to-thread assignment keeps the NUMA placement valid
+        return do_dynamic && !numa_aware;
     }
 
+namespace
+{
+    /** Advise the OS to back a memory range with transparent huge pages
+     *
+     * Only the whole pages inside of the range are advised.
+     */
+    void
+    advise_huge_pages ([[maybe_unused]] void * ptr, [[maybe_unused]] std::size_t bytes)
+    {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        auto const page_size = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+        auto const begin = (reinterpret_cast<std::uintptr_t>(ptr) + page_size - 1) / page_size * page_size;
+        auto const end = (reinterpret_cast<std::uintptr_t>(ptr) + bytes) / page_size * page_size;
+        if (end > begin) {
+            madvise(reinterpret_cast<void *>(begin), end - begin, MADV_HUGEPAGE);
+        }
+#endif
+    }
+} // namespace
+
     ParIter::ParIter (ContainerType& pc, int level)
         : amrex::ParIter<0, 0, RealSoA::nattribs, IntSoA::nattribs>(pc, level,
                    amrex::MFItInfo().SetDynamic(do_omp_dynamic())) {}
@@ -98,14 +142,64 @@ namespace impactx
         AMREX_ALWAYS_ASSERT(x.size() == pt.size());
 
         // number of particles to add
-        int const np = x.size();
+        auto const np = static_cast<amrex::Long>(x.size());
+        amrex::ParticleReal const w = bchchg/ablastr::constant::SI::q_e/np;
 
-        // have to resize here, not in the constructor because grids have not
-        // been built when constructor was called.
-        reserveData();
-        resizeData();
+        auto const chunks = AppendParticles(lev, np, qm, w);
+
+        // the weighting is only copied if it is stored per particle
+        amrex::Vector<amrex::ParticleReal> const w_host(
+            GetRealAttributeSoAIndex(RealUniform::w) < 0 ? 0 : np, w);
+        for (auto const & chunk : chunks) {
+            CopyParticlesFromHost(chunk, x, y, t, px, py, pt, qm, w_host);
+        }
+    }
+
+    void
+    ImpactXParticleContainer::AddNParticles (int lev,
+                                             amrex::Vector<amrex::ParticleReal> const & x,
+                                             amrex::Vector<amrex::ParticleReal> const & y,
+                                             amrex::Vector<amrex::ParticleReal> const & t,
+                                             amrex::Vector<amrex::ParticleReal> const & px,
+                                             amrex::Vector<amrex::ParticleReal> const & py,
+                                             amrex::Vector<amrex::ParticleReal> const & pt,
+                                             amrex::ParticleReal const & qm,
+                                             amrex::Vector<amrex::ParticleReal> const & w)
+    {
+        BL_PROFILE("ImpactX::AddNParticles");
+
+        AMREX_ALWAYS_ASSERT_WITH_MESSAGE(lev == 0, "AddNParticles: only lev=0 is supported yet.");
+        AMREX_ALWAYS_ASSERT(x.size() == y.size());
+        AMREX_ALWAYS_ASSERT(x.size() == t.size());
+        AMREX_ALWAYS_ASSERT(x.size() == px.size());
+        AMREX_ALWAYS_ASSERT(x.size() == py.size());
+        AMREX_ALWAYS_ASSERT(x.size() == pt.size());
+        AMREX_ALWAYS_ASSERT(x.size() == w.size());
+
+        // number of particles to add
+        auto const np = static_cast<amrex::Long>(x.size());
+
+        // the weighting differs between particles
+        SetRealAttributeVarying(RealUniform::w);
 
-        auto& particle_tile = DefineAndReturnParticleTile(0, 0, 0);
+        for (auto const & chunk : AppendParticles(lev, np, qm, 0.0)) {
+            CopyParticlesFromHost(chunk, x, y, t, px, py, pt, qm, w);
+        }
+    }
+
+    void
+    ImpactXParticleContainer::CopyParticlesFromHost (ParticleChunk const & chunk,
+                                                     amrex::Vector<amrex::ParticleReal> const & x,
+                                                     amrex::Vector<amrex::ParticleReal> const & y,
+                                                     amrex::Vector<amrex::ParticleReal> const & t,
+                                                     amrex::Vector<amrex::ParticleReal> const & px,
+                                                     amrex::Vector<amrex::ParticleReal> const & py,
+                                                     amrex::Vector<amrex::ParticleReal> const & pt,
+                                                     amrex::ParticleReal qm,
+                                                     amrex::Vector<amrex::ParticleReal> const & w)
+    {
+        int const np = chunk.np;
+        auto const first = static_cast<std::size_t>(chunk.first);
 
         /* Create a temporary tile to obtain data from simulation. This data
          * is then copied to the permanent tile which is stored on the particle
@@ -119,35 +213,257 @@ namespace impactx
         PinnedTile pinned_tile;
         pinned_tile.define(NumRuntimeRealComps(), NumRuntimeIntComps());
 
+        // reserve a contiguous block of particle ids
+        amrex::Long const id_begin = ParticleType::NextID();
+        ParticleType::NextID(id_begin + np);
+
         for (int i = 0; i < np; i++)
         {
             ParticleType p;
-            p.id() = ParticleType::NextID();
+            p.id() = id_begin + i;
             p.cpu() = amrex::ParallelDescriptor::MyProc();
-            p.pos(RealAoS::x) = x[i];
-            p.pos(RealAoS::y) = y[i];
-            p.pos(RealAoS::t) = t[i];
+            p.pos(RealAoS::x) = x[first + i];
+            p.pos(RealAoS::y) = y[first + i];
+            p.pos(RealAoS::t) = t[first + i];
             // write position, creating cpu id, and particle id
             pinned_tile.push_back(p);
         }
 
         // write Real attributes (SoA) to particle initialized zero
-        DefineAndReturnParticleTile(0, 0, 0);
+        pinned_tile.push_back_real(RealSoA::px, px.cbegin() + first, px.cbegin() + first + np);
+        pinned_tile.push_back_real(RealSoA::py, py.cbegin() + first, py.cbegin() + first + np);
+        pinned_tile.push_back_real(RealSoA::pt, pt.cbegin() + first, pt.cbegin() + first + np);
 
-        pinned_tile.push_back_real(RealSoA::px, px);
-        pinned_tile.push_back_real(RealSoA::py, py);
-        pinned_tile.push_back_real(RealSoA::pt, pt);
-        pinned_tile.push_back_real(RealSoA::qm, np, qm);
-        pinned_tile.push_back_real(RealSoA::w, np, bchchg/ablastr::constant::SI::q_e/np);
+        // qm and w are only written if they are stored per particle
+        int const qm_comp = GetRealAttributeSoAIndex(RealUniform::qm);
+        int const w_comp = GetRealAttributeSoAIndex(RealUniform::w);
+        for (int comp = RealSoA::nattribs; comp < RealSoA::nattribs + NumRuntimeRealComps(); ++comp) {
+            if (comp == qm_comp) { pinned_tile.push_back_real(comp, np, qm); }
+            else if (comp == w_comp) { pinned_tile.push_back_real(comp, w.cbegin() + first, w.cbegin() + first + np); }
+            else { pinned_tile.push_back_real(comp, np, 0.0); }
+        }
 
-        /* Redistributes particles to their respective tiles (spatial bucket
-         * sort per box over MPI ranks)
-         */
-        auto old_np = particle_tile.numParticles();
-        auto new_np = old_np + pinned_tile.numParticles();
-        particle_tile.resize(new_np);
         amrex::copyParticles(
-                particle_tile, pinned_tile, 0, old_np, pinned_tile.numParticles());
+                *chunk.tile, pinned_tile, 0, chunk.offset, pinned_tile.numParticles());
+    }
+
+    std::vector<ImpactXParticleContainer::ParticleChunk>
+    ImpactXParticleContainer::AppendParticles (int lev,
+                                               amrex::Long np,
+                                               amrex::ParticleReal qm,
+                                               amrex::ParticleReal w)
+    {
+        BL_PROFILE("ImpactX::AppendParticles");
+
+        AMREX_ALWAYS_ASSERT_WITH_MESSAGE(lev == 0, "AppendParticles: only lev=0 is supported yet.");
+
+        // keep qm and w as container-level values while they are the same for all particles
+        if (np > 0) {
+            for (auto const & [comp, value] : {std::make_pair(int(RealUniform::qm), qm),
+                                               std::make_pair(int(RealUniform::w), w)}) {
+                if (m_runtime_real_comp[comp] >= 0) { continue; }
+                if (!m_uniform_real[comp].has_value()) {
+                    m_uniform_real[comp] = value;
+                } else if (m_uniform_real[comp].value() != value) {
+                    SetRealAttributeVarying(comp);
+                }
+            }
+        }
+
+        // have to resize here, not in the constructor because grids have not
+        // been built when constructor was called.
+        reserveData();
+        resizeData();
+
+        // add to the boxes of this MPI rank, so the particles are visible to
+        // ParIter even if they are not redistributed
+        std::vector<std::pair<int, int>> tile_keys;
+        for (amrex::MFIter mfi = MakeMFIter(lev); mfi.isValid(); ++mfi) {
+            tile_keys.emplace_back(mfi.index(), mfi.LocalTileIndex());
+        }
+        if (tile_keys.empty()) { tile_keys.emplace_back(0, 0); }
+
+        // fill the particle tiles in turn, each up to the range of int
+        std::vector<ParticleChunk> chunks;
+        amrex::Long added = 0;
+        for (auto const & [grid, tile] : tile_keys) {
+            if (added == np) { break; }
+            auto & particle_tile = DefineAndReturnParticleTile(lev, grid, tile);
+
+            auto const old_np = particle_tile.numParticles();
+            auto const room = amrex::Long(std::numeric_limits<int>::max()) - old_np;
+            auto const n = static_cast<int>(std::min(room, np - added));
+            if (n <= 0) { continue; }
+            particle_tile.resize(old_np + n);
+
+            // set the attributes that are stored per particle
+            auto & soa = particle_tile.GetStructOfArrays();
+            for (auto const & [comp, value] : {std::make_pair(int(RealUniform::qm), qm),
+                                               std::make_pair(int(RealUniform::w), w)}) {
+                int const soa_comp = GetRealAttributeSoAIndex(comp);
+                if (soa_comp < 0) { continue; }
+                amrex::ParticleReal * const AMREX_RESTRICT part_v = soa.GetRealData(soa_comp).dataPtr() + old_np;
+                amrex::ParallelFor(n, [=] AMREX_GPU_DEVICE (int i) { part_v[i] = value; });
+            }
+
+            chunks.push_back({&particle_tile, old_np, n, added});
+            added += n;
+        }
+
+        if (added < np) {
+            throw std::runtime_error("AppendParticles: the particle tiles of this MPI rank cannot hold " +
+                                     std::to_string(np) + " more particles. Please use more MPI ranks or "
+                                     "particles.do_tiling = 1.");
+        }
+
+        return chunks;
+    }
+
+    void
+    ImpactXParticleContainer::NumaFirstTouch ()
+    {
+#if defined(AMREX_USE_OMP) && !defined(AMREX_USE_GPU)
+        BL_PROFILE("ImpactXParticleContainer::NumaFirstTouch");
+
+        amrex::ParmParse pp_impactx("impactx");
+        bool numa_aware = false;
+        bool huge_pages = false;
+        pp_impactx.query("numa_aware", numa_aware);
+        pp_impactx.query("huge_pages", huge_pages);
+        if (!numa_aware) { return; }
+
+        for (int lev = 0; lev <= finestLevel(); ++lev) {
+            // same tile-to-thread and particle-to-thread assignment as the particle loops
+#pragma omp parallel if (ThreadOverTiles(*this, lev))
+            for (ParIter pti(*this, lev); pti.isValid(); ++pti) {
+                auto & ptile = pti.GetParticleTile();
+                int const np = ptile.numParticles();
+
+                // new memory: its pages are only mapped to a NUMA domain when first written
+                ParticleTileType new_tile;
+                new_tile.define(NumRuntimeRealComps(), NumRuntimeIntComps());
+                new_tile.resize(np);
+
+                if (huge_pages) {
+                    auto & aos = new_tile.GetArrayOfStructs();
+                    advise_huge_pages(aos().dataPtr(), np * sizeof(ParticleType));
+                    auto & soa = new_tile.GetStructOfArrays();
+                    for (int comp = 0; comp < RealSoA::nattribs + NumRuntimeRealComps(); ++comp) {
+                        advise_huge_pages(soa.GetRealData(comp).dataPtr(), np * sizeof(amrex::ParticleReal));
+                    }
+                }
+
+                auto const src = ptile.getConstParticleTileData();
+                auto const dst = new_tile.getParticleTileData();
+                ParallelForParticles(np, [=] (int i) {
+                    amrex::copyParticle(dst, src, i, i);
+                });
+
+                ptile = std::move(new_tile);
+            }
+        }
+#endif
+    }
+
+    std::optional<amrex::ParticleReal>
+    ImpactXParticleContainer::GetUniformRealAttribute (int comp) const
+    {
+        if (m_runtime_real_comp.at(comp) >= 0) { return std::nullopt; }
+        return m_uniform_real.at(comp);
+    }
+
+    RealUniformAccessor
+    ImpactXParticleContainer::GetRealAttribute (int comp) const
+    {
+        return {m_runtime_real_comp.at(comp), m_uniform_real.at(comp).value_or(0.0)};
+    }
+
+    int
+    ImpactXParticleContainer::GetRealAttributeSoAIndex (int comp) const
+    {
+        int const runtime_comp = m_runtime_real_comp.at(comp);
+        return runtime_comp < 0 ? -1 : RealSoA::nattribs + runtime_comp;
+    }
+
+    void
+    ImpactXParticleContainer::SetRealAttributeVarying (int comp)
+    {
+        BL_PROFILE("ImpactXParticleContainer::SetRealAttributeVarying");
+
+        if (m_runtime_real_comp.at(comp) >= 0) { return; }
+
+        // communicated with the particles in Redistribute
+        AddRealComp(true);
+        int const runtime_comp = NumRuntimeRealComps() - 1;
+        m_runtime_real_comp.at(comp) = runtime_comp;
+
+        // the existing particles keep their value
+        amrex::ParticleReal const value = m_uniform_real.at(comp).value_or(0.0);
+        m_uniform_real.at(comp).reset();
+        for (int lev = 0; lev < static_cast<int>(GetParticles().size()); ++lev) {
+            for (auto & [index, particle_tile] : GetParticles(lev)) {
+                auto const np = particle_tile.numParticles();
+                particle_tile.define(NumRuntimeRealComps(), NumRuntimeIntComps());
+                particle_tile.resize(np);
+
+                amrex::ParticleReal * const AMREX_RESTRICT part_v =
+                    particle_tile.GetStructOfArrays().GetRealData(RealSoA::nattribs + runtime_comp).dataPtr();
+                amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) { part_v[i] = value; });
+            }
+        }
+        amrex::Gpu::streamSynchronize();
+    }
+
+    void
+    ImpactXParticleContainer::SyncRealAttributes ()
+    {
+        BL_PROFILE("ImpactXParticleContainer::SyncRealAttributes");
+
+        using amrex::ParticleReal;
+
+        std::array<int, RealUniform::nattribs> varying;
+        std::array<ParticleReal, RealUniform::nattribs> v_min;
+        std::array<ParticleReal, RealUniform::nattribs> v_max;
+        for (int comp = 0; comp < RealUniform::nattribs; ++comp) {
+            varying[comp] = m_runtime_real_comp[comp] >= 0 ? 1 : 0;
+            v_min[comp] = m_uniform_real[comp].value_or(std::numeric_limits<ParticleReal>::max());
+            v_max[comp] = m_uniform_real[comp].value_or(std::numeric_limits<ParticleReal>::lowest());
+        }
+
+        auto const comm = amrex::ParallelDescriptor::Communicator();
+        amrex::ParallelAllReduce::Max(varying.data(), RealUniform::nattribs, comm);
+        amrex::ParallelAllReduce::Min(v_min.data(), RealUniform::nattribs, comm);
+        amrex::ParallelAllReduce::Max(v_max.data(), RealUniform::nattribs, comm);
+
+        // in the same order on all ranks, so the runtime components match
+        for (int comp = 0; comp < RealUniform::nattribs; ++comp) {
+            // no rank added particles yet
+            if (varying[comp] == 0 && v_min[comp] > v_max[comp]) { continue; }
+
+            // the weighting can be computed per rank from a share of the
+            // bunch charge, which can differ in the last bits
+            auto const tolerance = 4 * std::numeric_limits<ParticleReal>::epsilon() * std::abs(v_max[comp]);
+            if (varying[comp] == 0 && v_max[comp] - v_min[comp] <= tolerance) {
+                m_uniform_real[comp] = v_max[comp];
+            } else {
+                SetRealAttributeVarying(comp);
+            }
+        }
+
+        // ranks that stored both attributes per particle before in a different
+        // order swap them, so the runtime components are the same on all ranks
+        int & qm_comp = m_runtime_real_comp[RealUniform::qm];
+        int & w_comp = m_runtime_real_comp[RealUniform::w];
+        if (qm_comp > w_comp && w_comp >= 0) {
+            for (int lev = 0; lev < static_cast<int>(GetParticles().size()); ++lev) {
+                for (auto & [index, particle_tile] : GetParticles(lev)) {
+                    auto & soa = particle_tile.GetStructOfArrays();
+                    std::swap(soa.GetRealData(RealSoA::nattribs + qm_comp),
+                              soa.GetRealData(RealSoA::nattribs + w_comp));
+                }
+            }
+            std::swap(qm_comp, w_comp);
+        }
     }
 
     void
@@ -182,6 +498,78 @@ namespace impactx
         return ablastr::particles::MinAndMaxPositions(*this);
     }
 
+    std::tuple<
+            amrex::ParticleReal, amrex::ParticleReal,
+            amrex::ParticleReal, amrex::ParticleReal,
+            amrex::ParticleReal, amrex::ParticleReal>
+    ImpactXParticleContainer::QuantilePositions (amrex::ParticleReal fraction)
+    {
+        BL_PROFILE("ImpactXParticleContainer::QuantilePositions");
+
+        using namespace amrex::literals;
+
+        auto const [x_min, y_min, z_min, x_max, y_max, z_max] = MinAndMaxPositions();
+        if (fraction >= 1.0_prt || x_min == x_max || y_min == y_max || z_min == z_max)
+            return {x_min, y_min, z_min, x_max, y_max, z_max};
+
+        // histogram of the particle positions per dimension, weighted by the particle weighting
+        int const nbins = 4096;
+        amrex::GpuArray<amrex::ParticleReal, 3> const pos_min{x_min, y_min, z_min};
+        amrex::GpuArray<amrex::ParticleReal, 3> const bin_width{
+            (x_max - x_min) / nbins, (y_max - y_min) / nbins, (z_max - z_min) / nbins};
+
+        amrex::Gpu::DeviceVector<amrex::Real> d_hist(3 * nbins, 0.0_rt);
+        amrex::Real * const AMREX_RESTRICT hist = d_hist.data();
+
+        using PType = ImpactXParticleContainer::ParticleType;
+        for (int lev = 0; lev <= finestLevel(); ++lev) {
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#endif
+            for (ParIter pti(*this, lev); pti.isValid(); ++pti) {
+                int const np = pti.numParticles();
+                PType const * const AMREX_RESTRICT aos_ptr = pti.GetArrayOfStructs()().dataPtr();
+                auto const ptd = pti.GetParticleTile().getConstParticleTileData();
+                RealUniformAccessor const part_w = GetRealAttribute(RealUniform::w);
+
+                amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) {
+                    PType const & p = aos_ptr[i];
+                    auto const w = amrex::Real(part_w(ptd, i));
+                    for (int d = 0; d < 3; ++d) {
+                        int const bin = amrex::min(nbins - 1, amrex::max(0,
+                            static_cast<int>((p.pos(d) - pos_min[d]) / bin_width[d])));
+                        amrex::HostDevice::Atomic::Add(hist + d * nbins + bin, w);
+                    }
+                });
+            }
+        }
+
+        std::vector<amrex::Real> h_hist(3 * nbins);
+        amrex::Gpu::copyAsync(amrex::Gpu::deviceToHost, d_hist.begin(), d_hist.end(), h_hist.begin());
+        amrex::Gpu::streamSynchronize();
+        amrex::ParallelDescriptor::ReduceRealSum(h_hist.data(), static_cast<int>(h_hist.size()));
+
+        // weighting of the particles to leave out below and above per dimension
+        amrex::Real const w_total = std::accumulate(h_hist.begin(), h_hist.begin() + nbins, 0.0_rt);
+        amrex::Real const w_cut = (1.0_rt - amrex::Real(fraction)) / 2.0_rt * w_total;
+
+        std::array<amrex::ParticleReal, 3> lo;
+        std::array<amrex::ParticleReal, 3> hi;
+        for (int d = 0; d < 3; ++d) {
+            amrex::Real const * const h = h_hist.data() + d * nbins;
+
+            int bin_lo = 0;
+            for (amrex::Real below = h[0]; below <= w_cut && bin_lo < nbins - 1; below += h[++bin_lo]) {}
+            int bin_hi = nbins - 1;
+            for (amrex::Real above = h[nbins - 1]; above <= w_cut && bin_hi > bin_lo; above += h[--bin_hi]) {}
+
+            lo[d] = pos_min[d] + bin_lo * bin_width[d];
+            hi[d] = pos_min[d] + (bin_hi + 1) * bin_width[d];
+        }
+
+        return {lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]};
+    }
+
     std::tuple<
             amrex::ParticleReal, amrex::ParticleReal,
             amrex::ParticleReal, amrex::ParticleReal,
@@ -189,8 +577,54 @@ namespace impactx
     ImpactXParticleContainer::MeanAndStdPositions ()
     {
         BL_PROFILE("ImpactXParticleContainer::MeanAndStdPositions");
-        return ablastr::particles::MeanAndStdPositions<
-            ImpactXParticleContainer, RealSoA::w
-        >(*this);
+
+        using namespace amrex::literals;
+        using PTDType = ParticleTileType::ConstParticleTileDataType;
+
+        RealUniformAccessor const part_w = GetRealAttribute(RealUniform::w);
+
+        amrex::ReduceOps<
+            amrex::ReduceOpSum, amrex::ReduceOpSum, amrex::ReduceOpSum, amrex::ReduceOpSum,
+            amrex::ReduceOpSum, amrex::ReduceOpSum, amrex::ReduceOpSum
+        > reduce_ops;
+        // accumulate in amrex::Real, also for single precision particles
+        using amrex::Real;
+        auto r = amrex::ParticleReduce<
+            amrex::ReduceData<
+                Real, Real, Real, Real,
+                Real, Real, Real
+            >
+        >(
+            *this,
+            [=] AMREX_GPU_DEVICE (const PTDType& ptd, const int i) noexcept
+            -> amrex::GpuTuple<
+                Real, Real, Real, Real,
+                Real, Real, Real
+            >
+            {
+                Real const w = part_w(ptd, i);
+                Real const x = ptd.m_aos[i].pos(RealAoS::x);
+                Real const y = ptd.m_aos[i].pos(RealAoS::y);
+                Real const z = ptd.m_aos[i].pos(RealAoS::z);
+                return {w, w * x, w * y, w * z, w * x * x, w * y * y, w * z * z};
+            },
+            reduce_ops
+        );
+
+        std::vector<Real> sums = {
+            amrex::get<0>(r), amrex::get<1>(r), amrex::get<2>(r), amrex::get<3>(r),
+            amrex::get<4>(r), amrex::get<5>(r), amrex::get<6>(r)
+        };
+        amrex::ParallelAllReduce::Sum(sums.data(), sums.size(), amrex::ParallelDescriptor::Communicator());
+
+        Real const w_sum = sums[0];
+        if (w_sum <= 0.0_rt) { return {0.0_prt, 0.0_prt, 0.0_prt, 0.0_prt, 0.0_prt, 0.0_prt}; }
+
+        std::array<Real, 3> mean, sigma;
+        for (int d = 0; d < 3; ++d) {
+            mean[d] = sums[1 + d] / w_sum;
+            sigma[d] = std::sqrt(std::max(sums[4 + d] / w_sum - mean[d] * mean[d], 0.0_rt));
+        }
+        return {mean[0], sigma[0], mean[1], sigma[1], mean[2], sigma[2]};
     }
 } // namespace impactx
@@ -0,0 +1,73 @@
+/* Copyright 2022-2023 The Regents of the University of California, through Lawrence
+ *           Berkeley National Laboratory (subject to receipt of any required
+ *           approvals from the U.S. Dept. of Energy). All rights reserved.
+ *
+ * This file is part of ImpactX.
+ *
+ * Authors: Axel Huebl
+ * License: BSD-3-Clause-LBNL
+ */
+#include "ParallelForParticles.H"
+
+#include <AMReX.H>
+#include <AMReX_OpenMP.H>
+#include <AMReX_ParmParse.H>
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace impactx
+{
+    bool
+    ThreadOverTiles (ImpactXParticleContainer const & pc, int lev)
+    {
+        std::string cpu_threading = "auto";
+        amrex::ParmParse("impactx").queryAdd("cpu_threading", cpu_threading);
+        if (cpu_threading != "auto" && cpu_threading != "tiles" && cpu_threading != "particles")
+            throw std::runtime_error("impactx.cpu_threading must be auto, tiles or particles but is: " + cpu_threading);
+
+#if defined(AMREX_USE_OMP) && !defined(AMREX_USE_GPU)
+        if (cpu_threading == "tiles") { return true; }
+        if (cpu_threading == "particles") { return false; }
+
+        int const nthreads = amrex::OpenMP::get_max_threads();
+        if (nthreads <= 1) { return true; }
+
+        // particle count per tile, in the order ParIter visits the tiles
+        std::vector<amrex::Long> tile_np;
+        for (auto const & kv : pc.GetParticles(lev)) {
+            tile_np.push_back(kv.second.numParticles());
+        }
+        amrex::Long const total = std::accumulate(tile_np.begin(), tile_np.end(), amrex::Long(0));
+        if (total == 0) { return true; }
+
+        // estimate the particles pushed by the most loaded thread if threads work on tiles
+        std::vector<amrex::Long> thread_np(static_cast<std::size_t>(nthreads), 0);
+        if (do_omp_dynamic()) {
+            // each tile is picked up by the thread that becomes idle first
+            for (amrex::Long const np : tile_np) {
+                *std::min_element(thread_np.begin(), thread_np.end()) += np;
+            }
+        } else {
+            // contiguous chunks of tiles per thread
+            int const ntiles = static_cast<int>(tile_np.size());
+            for (int i = 0; i < ntiles; ++i) {
+                thread_np[static_cast<std::size_t>(i) * nthreads / ntiles] += tile_np[i];
+            }
+        }
+        amrex::Long const max_thread_np = *std::max_element(thread_np.begin(), thread_np.end());
+
+        // threads over particles are balanced up to one particle
+        amrex::Real const max_imbalance = 1.1;
+        return amrex::Real(max_thread_np) * amrex::Real(nthreads) <= max_imbalance * amrex::Real(total);
+#else
+        amrex::ignore_unused(pc, lev);
+        return true;
+#endif
+    }
+} // namespace impactx
@@ -0,0 +1,119 @@
+/* Copyright 2022-2023 The Regents of the University of California, through Lawrence
+ *           Berkeley National Laboratory (subject to receipt of any required
+ *           approvals from the U.S. Dept. of Energy). All rights reserved.
+ *
+ * This file is part of ImpactX.
+ *
+ * Authors: Axel Huebl
+ * License: BSD-3-Clause-LBNL
+ */
+#include "ImpactXParticleContainer.H"
+
+#include <AMReX_Array.H>
+#include <AMReX_BLProfiler.H>
+#include <AMReX_DenseBins.H>
+#include <AMReX_Geometry.H>
+#include <AMReX_GpuQualifiers.H>
+#include <AMReX_IntVect.H>
+#include <AMReX_Math.H>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+
+namespace impactx
+{
+    void
+    ImpactXParticleContainer::SortParticles (std::string const & sort_type)
+    {
+        BL_PROFILE("ImpactXParticleContainer::SortParticles");
+
+        if (sort_type == "cell") {
+            BL_PROFILE("ImpactXParticleContainer::SortParticles::cell");
+            this->SortParticlesByBin(amrex::IntVect(1));
+        }
+        else if (sort_type == "morton") {
+            BL_PROFILE("ImpactXParticleContainer::SortParticles::morton");
+            using PType = ImpactXParticleContainer::ParticleType;
+
+            // the Morton index must fit in an int
+            constexpr int max_bits = 30;
+
+            int const nLevel = this->finestLevel();
+            for (int lev = 0; lev <= nLevel; ++lev) {
+                amrex::Geometry const & gm = this->Geom(lev);
+                auto const plo = gm.ProbLoArray();
+                auto const dxi = gm.InvCellSizeArray();
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#endif
+                {
+                    amrex::DenseBins<PType> bins;
+
+                    for (ParIter pti(*this, lev); pti.isValid(); ++pti) {
+                        int const np = pti.numParticles();
+                        if (np < 2) { continue; }
+
+                        // bits per dimension to enumerate the cells of the tile
+                        amrex::Box const bx = pti.tilebox();
+                        amrex::GpuArray<int, 3> nbits{0, 0, 0};
+                        amrex::GpuArray<int, 3> shift{0, 0, 0};
+                        int total_bits = 0;
+                        for (int d = 0; d < 3; ++d) {
+                            while ((1 << nbits[d]) < bx.length(d)) { ++nbits[d]; }
+                            total_bits += nbits[d];
+                        }
+
+                        // no more than about 8 bins per particle: finer bins do not improve the
+                        // locality, but their offsets cost memory; coarsen the longest dimensions
+                        int np_bits = 0;
+                        while ((amrex::Long(1) << np_bits) < np) { ++np_bits; }
+                        int const bits_limit = std::min(max_bits, np_bits + 3);
+                        while (total_bits > bits_limit) {
+                            int const d = static_cast<int>(std::max_element(nbits.begin(), nbits.end()) - nbits.begin());
+                            --nbits[d];
+                            ++shift[d];
+                            --total_bits;
+                        }
+                        int const nbins = 1 << total_bits;
+                        int const level_bits = std::max({nbits[0], nbits[1], nbits[2]});
+
+                        amrex::IntVect const lo = bx.smallEnd();
+                        amrex::IntVect const hi = bx.bigEnd();
+
+                        auto const morton_index = [=] AMREX_GPU_DEVICE (PType const & p) noexcept -> unsigned int
+                        {
+                            // cell index relative to the tile, clamped for particles
+                            // slightly outside of the tile
+                            unsigned int idx[3];
+                            for (int d = 0; d < 3; ++d) {
+                                int c = static_cast<int>(amrex::Math::floor((p.pos(d) - plo[d]) * dxi[d]));
+                                c = amrex::min(amrex::max(c, lo[d]), hi[d]);
+                                idx[d] = static_cast<unsigned int>(c - lo[d]) >> shift[d];
+                            }
+
+                            // interleave the bits, dimensions that ran out of bits are skipped
+                            unsigned int index = 0;
+                            int pos = 0;
+                            for (int b = 0; b < level_bits; ++b) {
+                                for (int d = 0; d < 3; ++d) {
+                                    if (b < nbits[d]) { index |= ((idx[d] >> b) & 1u) << pos++; }
+                                }
+                            }
+                            return index;
+                        };
+
+                        auto const & aos = pti.GetArrayOfStructs();
+                        bins.build(np, aos().dataPtr(), nbins, morton_index);
+                        this->ReorderParticles(lev, pti, bins.permutationPtr());
+                    }
+                }
+            }
+        }
+        else {
+            throw std::runtime_error("SortParticles: sort type must be cell or morton but is: " + sort_type);
+        }
+    }
+} // namespace impactx
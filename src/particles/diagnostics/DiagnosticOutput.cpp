@@ -10,6 +10,7 @@
 #include "DiagnosticOutput.H"
 #include "NonlinearLensInvariants.H"
 #include "ReducedBeamCharacteristics.H"
+#include "StagingBuffer.H"
 
 #include <ablastr/particles/IndexHandling.H>
 
@@ -19,10 +20,13 @@
 #include <AMReX_REAL.H>       // for ParticleReal
 #include <AMReX_Print.H>      // for PrintToFile
 
+#include <vector>
+
 
 namespace impactx::diagnostics
 {
     void DiagnosticOutput (ImpactXParticleContainer const & pc,
+                           std::shared_ptr<StagingContainer> & staging_buffer,
                            OutputType const otype,
                            std::string file_name,
                            int const step,
@@ -72,18 +76,22 @@ namespace impactx::diagnostics
                          << rbc.at("charge_C") << "\n";
         } // if( otype == OutputType::PrintReducedBeamCharacteristics)
 
-        // create a host-side particle buffer
-        auto tmp = pc.make_alike<amrex::PinnedArenaAllocator>();
-
-        // copy device-to-host
-        bool const local = true;
-        tmp.copyParticles(pc, local);
+        // copy the attributes we print device-to-host
+        bool const copy_aos = otype == OutputType::PrintParticles ||
+                              otype == OutputType::PrintNonlinearLensInvariants;
+        std::vector<int> real_soa_comps;
+        if (otype == OutputType::PrintParticles) {
+            real_soa_comps = {RealSoA::px, RealSoA::py, RealSoA::pt};
+        } else if (otype == OutputType::PrintNonlinearLensInvariants) {
+            real_soa_comps = {RealSoA::px, RealSoA::py};
+        }
+        StagingContainer & tmp = StageParticles(staging_buffer, pc, copy_aos, real_soa_comps);
 
         // loop over refinement levels
         int const nLevel = tmp.finestLevel();
         for (int lev = 0; lev <= nLevel; ++lev) {
             // loop over all particle boxes
-            using ParIt = typename decltype(tmp)::ParConstIterType;
+            using ParIt = StagingContainer::ParConstIterType;
             for (ParIt pti(tmp, lev); pti.isValid(); ++pti) {
                 const int np = pti.numParticles();
 
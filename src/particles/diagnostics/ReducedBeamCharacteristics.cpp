@@ -15,12 +15,13 @@
 
 #include <AMReX_BLProfiler.H>           // for TinyProfiler
 #include <AMReX_GpuQualifiers.H>        // for AMREX_GPU_DEVICE
-#include <AMReX_REAL.H>                 // for ParticleReal
+#include <AMReX_REAL.H>                 // for Real, ParticleReal
 #include <AMReX_Reduce.H>               // for ReduceOps
 #include <AMReX_ParallelDescriptor.H>   // for ParallelDescriptor
 #include <AMReX_ParticleReduce.H>       // for ParticleReduce
 
 
+
 namespace impactx::diagnostics
 {
     std::unordered_map<std::string, amrex::ParticleReal>
@@ -31,10 +32,16 @@ namespace impactx::diagnostics
         // preparing to access reference particle data: RefPart
         RefPart const ref_part = pc.GetRefParticle();
         // reference particle charge in C
-        amrex::ParticleReal const q_C = ref_part.charge;
+        amrex::Real const q_C = ref_part.charge;
 
         // preparing access to particle data: AoS and SoA
-        using PType = typename ImpactXParticleContainer::SuperParticleType;
+        using PTDType = ImpactXParticleContainer::ParticleTileType::ConstParticleTileDataType;
+
+        // moments are accumulated in amrex::Real, which is double precision
+        // also if the particles are stored in single precision
+
+        // the weighting of the container if it is the same for all particles, otherwise per particle
+        RealUniformAccessor const part_w = pc.GetRealAttribute(RealUniform::w);
 
         amrex::ReduceOps<
             amrex::ReduceOpSum, amrex::ReduceOpSum, amrex::ReduceOpSum,
@@ -44,38 +51,38 @@ namespace impactx::diagnostics
 
         auto r = amrex::ParticleReduce<
             amrex::ReduceData<
-                amrex::ParticleReal, amrex::ParticleReal, amrex::ParticleReal,
-                amrex::ParticleReal, amrex::ParticleReal, amrex::ParticleReal,
-                amrex::ParticleReal
+                amrex::Real, amrex::Real, amrex::Real,
+                amrex::Real, amrex::Real, amrex::Real,
+                amrex::Real
             >
         >(
             pc,
-            [=] AMREX_GPU_DEVICE (const PType& p) noexcept
+            [=] AMREX_GPU_DEVICE (const PTDType& ptd, const int i) noexcept
             -> amrex::GpuTuple<
-                amrex::ParticleReal, amrex::ParticleReal, amrex::ParticleReal,
-                amrex::ParticleReal, amrex::ParticleReal, amrex::ParticleReal,
-                amrex::ParticleReal
+                amrex::Real, amrex::Real, amrex::Real,
+                amrex::Real, amrex::Real, amrex::Real,
+                amrex::Real
             >
             {
                 // access AoS particle position data
-                const amrex::ParticleReal p_pos0 = p.pos(0);
-                const amrex::ParticleReal p_pos1 = p.pos(1);
-                const amrex::ParticleReal p_pos2 = p.pos(2);
+                const amrex::Real p_pos0 = ptd.m_aos[i].pos(0);
+                const amrex::Real p_pos1 = ptd.m_aos[i].pos(1);
+                const amrex::Real p_pos2 = ptd.m_aos[i].pos(2);
 
                 // access SoA particle momentum data and weighting
-                const amrex::ParticleReal p_w = p.rdata(RealSoA::w);
-                const amrex::ParticleReal p_px = p.rdata(RealSoA::px);
-                const amrex::ParticleReal p_py = p.rdata(RealSoA::py);
-                const amrex::ParticleReal p_pt = p.rdata(RealSoA::pt);
+                const amrex::Real p_w = part_w(ptd, i);
+                const amrex::Real p_px = ptd.m_rdata[RealSoA::px][i];
+                const amrex::Real p_py = ptd.m_rdata[RealSoA::py][i];
+                const amrex::Real p_pt = ptd.m_rdata[RealSoA::pt][i];
 
                 // prepare mean position values
-                const amrex::ParticleReal p_x_mean = p_pos0*p_w;
-                const amrex::ParticleReal p_y_mean = p_pos1*p_w;
-                const amrex::ParticleReal p_t_mean = p_pos2*p_w;
+                const amrex::Real p_x_mean = p_pos0*p_w;
+                const amrex::Real p_y_mean = p_pos1*p_w;
+                const amrex::Real p_t_mean = p_pos2*p_w;
 
-                const amrex::ParticleReal p_px_mean = p_px*p_w;
-                const amrex::ParticleReal p_py_mean = p_py*p_w;
-                const amrex::ParticleReal p_pt_mean = p_pt*p_w;
+                const amrex::Real p_px_mean = p_px*p_w;
+                const amrex::Real p_py_mean = p_py*p_w;
+                const amrex::Real p_pt_mean = p_pt*p_w;
 
                 return {p_w,
                         p_x_mean, p_y_mean, p_t_mean,
@@ -84,7 +91,7 @@ namespace impactx::diagnostics
             reduce_ops
         );
 
-        std::vector<amrex::ParticleReal> values_per_rank_1st = {
+        std::vector<amrex::Real> values_per_rank_1st = {
                 amrex::get<0>(r), // w
                 amrex::get<1>(r), // x_mean
                 amrex::get<2>(r), // y_mean
@@ -101,13 +108,13 @@ namespace impactx::diagnostics
             amrex::ParallelDescriptor::Communicator()
         );
 
-        amrex::ParticleReal w_sum   = values_per_rank_1st.at(0);
-        amrex::ParticleReal x_mean  = values_per_rank_1st.at(1) /= w_sum;
-        amrex::ParticleReal y_mean  = values_per_rank_1st.at(2) /= w_sum;
-        amrex::ParticleReal t_mean  = values_per_rank_1st.at(3) /= w_sum;
-        amrex::ParticleReal px_mean = values_per_rank_1st.at(4) /= w_sum;
-        amrex::ParticleReal py_mean = values_per_rank_1st.at(5) /= w_sum;
-        amrex::ParticleReal pt_mean = values_per_rank_1st.at(6) /= w_sum;
+        amrex::Real w_sum   = values_per_rank_1st.at(0);
+        amrex::Real x_mean  = values_per_rank_1st.at(1) /= w_sum;
+        amrex::Real y_mean  = values_per_rank_1st.at(2) /= w_sum;
+        amrex::Real t_mean  = values_per_rank_1st.at(3) /= w_sum;
+        amrex::Real px_mean = values_per_rank_1st.at(4) /= w_sum;
+        amrex::Real py_mean = values_per_rank_1st.at(5) /= w_sum;
+        amrex::Real pt_mean = values_per_rank_1st.at(6) /= w_sum;
 
 
         amrex::ReduceOps<
@@ -120,47 +127,47 @@ namespace impactx::diagnostics
 
         auto r2 = amrex::ParticleReduce<
             amrex::ReduceData<
-                amrex::ParticleReal, amrex::ParticleReal, amrex::ParticleReal,
-                amrex::ParticleReal, amrex::ParticleReal, amrex::ParticleReal,
-                amrex::ParticleReal, amrex::ParticleReal, amrex::ParticleReal,
-                amrex::ParticleReal
+                amrex::Real, amrex::Real, amrex::Real,
+                amrex::Real, amrex::Real, amrex::Real,
+                amrex::Real, amrex::Real, amrex::Real,
+                amrex::Real
             >
         >(
             pc,
-            [=] AMREX_GPU_DEVICE(const PType& p) noexcept
+            [=] AMREX_GPU_DEVICE (const PTDType& ptd, const int i) noexcept
             -> amrex::GpuTuple<
-                amrex::ParticleReal, amrex::ParticleReal, amrex::ParticleReal,
-                amrex::ParticleReal, amrex::ParticleReal, amrex::ParticleReal,
-                amrex::ParticleReal, amrex::ParticleReal, amrex::ParticleReal,
-                amrex::ParticleReal
+                amrex::Real, amrex::Real, amrex::Real,
+                amrex::Real, amrex::Real, amrex::Real,
+                amrex::Real, amrex::Real, amrex::Real,
+                amrex::Real
             >
             {
                 // access SoA particle momentum data and weighting
-                const amrex::ParticleReal p_w = p.rdata(RealSoA::w);
-                const amrex::ParticleReal p_px = p.rdata(RealSoA::px);
-                const amrex::ParticleReal p_py = p.rdata(RealSoA::py);
-                const amrex::ParticleReal p_pt = p.rdata(RealSoA::pt);
+                const amrex::Real p_w = part_w(ptd, i);
+                const amrex::Real p_px = ptd.m_rdata[RealSoA::px][i];
+                const amrex::Real p_py = ptd.m_rdata[RealSoA::py][i];
+                const amrex::Real p_pt = ptd.m_rdata[RealSoA::pt][i];
                 // access AoS particle position data
-                const amrex::ParticleReal p_pos0 = p.pos(0);
-                const amrex::ParticleReal p_pos1 = p.pos(1);
-                const amrex::ParticleReal p_pos2 = p.pos(2);
-                const amrex::ParticleReal p_x = p_pos0;
-                const amrex::ParticleReal p_y = p_pos1;
-                const amrex::ParticleReal p_t = p_pos2;
+                const amrex::Real p_pos0 = ptd.m_aos[i].pos(0);
+                const amrex::Real p_pos1 = ptd.m_aos[i].pos(1);
+                const amrex::Real p_pos2 = ptd.m_aos[i].pos(2);
+                const amrex::Real p_x = p_pos0;
+                const amrex::Real p_y = p_pos1;
+                const amrex::Real p_t = p_pos2;
                 // prepare mean square for positions
-                const amrex::ParticleReal p_x_ms = (p_x-x_mean)*(p_x-x_mean)*p_w;
-                const amrex::ParticleReal p_y_ms = (p_y-y_mean)*(p_y-y_mean)*p_w;
-                const amrex::ParticleReal p_t_ms = (p_t-t_mean)*(p_t-t_mean)*p_w;
+                const amrex::Real p_x_ms = (p_x-x_mean)*(p_x-x_mean)*p_w;
+                const amrex::Real p_y_ms = (p_y-y_mean)*(p_y-y_mean)*p_w;
+                const amrex::Real p_t_ms = (p_t-t_mean)*(p_t-t_mean)*p_w;
                 // prepare mean square for momenta
-                const amrex::ParticleReal p_px_ms = (p_px-px_mean)*(p_px-px_mean)*p_w;
-                const amrex::ParticleReal p_py_ms = (p_py-py_mean)*(p_py-py_mean)*p_w;
-                const amrex::ParticleReal p_pt_ms = (p_pt-pt_mean)*(p_pt-pt_mean)*p_w;
+                const amrex::Real p_px_ms = (p_px-px_mean)*(p_px-px_mean)*p_w;
+                const amrex::Real p_py_ms = (p_py-py_mean)*(p_py-py_mean)*p_w;
+                const amrex::Real p_pt_ms = (p_pt-pt_mean)*(p_pt-pt_mean)*p_w;
 
-                const amrex::ParticleReal p_xpx = (p_x-x_mean)*(p_px-px_mean)*p_w;
-                const amrex::ParticleReal p_ypy = (p_y-y_mean)*(p_py-py_mean)*p_w;
-                const amrex::ParticleReal p_tpt = (p_t-t_mean)*(p_pt-pt_mean)*p_w;
+                const amrex::Real p_xpx = (p_x-x_mean)*(p_px-px_mean)*p_w;
+                const amrex::Real p_ypy = (p_y-y_mean)*(p_py-py_mean)*p_w;
+                const amrex::Real p_tpt = (p_t-t_mean)*(p_pt-pt_mean)*p_w;
 
-                const amrex::ParticleReal p_charge = q_C*p_w;
+                const amrex::Real p_charge = q_C*p_w;
 
                 return {p_x_ms, p_y_ms, p_t_ms,
                         p_px_ms, p_py_ms, p_pt_ms,
@@ -170,7 +177,7 @@ namespace impactx::diagnostics
             reduce_ops2
         );
 
-        std::vector<amrex::ParticleReal> values_per_rank_2nd = {
+        std::vector<amrex::Real> values_per_rank_2nd = {
                 amrex::get<0>(r2), // x_ms
                 amrex::get<1>(r2), // y_ms
                 amrex::get<2>(r2), // t_ms
@@ -190,36 +197,36 @@ namespace impactx::diagnostics
             amrex::ParallelDescriptor::IOProcessorNumber()
         );
 
-        amrex::ParticleReal x_ms   = values_per_rank_2nd.at(0) /= w_sum;
-        amrex::ParticleReal y_ms   = values_per_rank_2nd.at(1) /= w_sum;
-        amrex::ParticleReal t_ms   = values_per_rank_2nd.at(2) /= w_sum;
-        amrex::ParticleReal px_ms  = values_per_rank_2nd.at(3) /= w_sum;
-        amrex::ParticleReal py_ms  = values_per_rank_2nd.at(4) /= w_sum;
-        amrex::ParticleReal pt_ms  = values_per_rank_2nd.at(5) /= w_sum;
-        amrex::ParticleReal xpx    = values_per_rank_2nd.at(6) /= w_sum;
-        amrex::ParticleReal ypy    = values_per_rank_2nd.at(7) /= w_sum;
-        amrex::ParticleReal tpt    = values_per_rank_2nd.at(8) /= w_sum;
-        amrex::ParticleReal charge = values_per_rank_2nd.at(9);
+        amrex::Real x_ms   = values_per_rank_2nd.at(0) /= w_sum;
+        amrex::Real y_ms   = values_per_rank_2nd.at(1) /= w_sum;
+        amrex::Real t_ms   = values_per_rank_2nd.at(2) /= w_sum;
+        amrex::Real px_ms  = values_per_rank_2nd.at(3) /= w_sum;
+        amrex::Real py_ms  = values_per_rank_2nd.at(4) /= w_sum;
+        amrex::Real pt_ms  = values_per_rank_2nd.at(5) /= w_sum;
+        amrex::Real xpx    = values_per_rank_2nd.at(6) /= w_sum;
+        amrex::Real ypy    = values_per_rank_2nd.at(7) /= w_sum;
+        amrex::Real tpt    = values_per_rank_2nd.at(8) /= w_sum;
+        amrex::Real charge = values_per_rank_2nd.at(9);
         // standard deviations of positions
-        amrex::ParticleReal sig_x = std::sqrt(x_ms);
-        amrex::ParticleReal sig_y = std::sqrt(y_ms);
-        amrex::ParticleReal sig_t = std::sqrt(t_ms);
+        amrex::Real sig_x = std::sqrt(x_ms);
+        amrex::Real sig_y = std::sqrt(y_ms);
+        amrex::Real sig_t = std::sqrt(t_ms);
         // standard deviations of momenta
-        amrex::ParticleReal sig_px = std::sqrt(px_ms);
-        amrex::ParticleReal sig_py = std::sqrt(py_ms);
-        amrex::ParticleReal sig_pt = std::sqrt(pt_ms);
+        amrex::Real sig_px = std::sqrt(px_ms);
+        amrex::Real sig_py = std::sqrt(py_ms);
+        amrex::Real sig_pt = std::sqrt(pt_ms);
         // RMS emittances
-        amrex::ParticleReal emittance_x = std::sqrt(x_ms*px_ms-xpx*xpx);
-        amrex::ParticleReal emittance_y = std::sqrt(y_ms*py_ms-ypy*ypy);
-        amrex::ParticleReal emittance_t = std::sqrt(t_ms*pt_ms-tpt*tpt);
+        amrex::Real emittance_x = std::sqrt(x_ms*px_ms-xpx*xpx);
+        amrex::Real emittance_y = std::sqrt(y_ms*py_ms-ypy*ypy);
+        amrex::Real emittance_t = std::sqrt(t_ms*pt_ms-tpt*tpt);
         // Courant-Snyder (Twiss) beta-function
-        amrex::ParticleReal beta_x = x_ms / emittance_x;
-        amrex::ParticleReal beta_y = y_ms / emittance_y;
-        amrex::ParticleReal beta_t = t_ms / emittance_t;
+        amrex::Real beta_x = x_ms / emittance_x;
+        amrex::Real beta_y = y_ms / emittance_y;
+        amrex::Real beta_t = t_ms / emittance_t;
         // Courant-Snyder (Twiss) alpha
-        amrex::ParticleReal alpha_x = - xpx / emittance_x;
-        amrex::ParticleReal alpha_y = - ypy / emittance_y;
-        amrex::ParticleReal alpha_t = - tpt / emittance_t;
+        amrex::Real alpha_x = - xpx / emittance_x;
+        amrex::Real alpha_y = - ypy / emittance_y;
+        amrex::Real alpha_t = - tpt / emittance_t;
 
         std::unordered_map<std::string, amrex::ParticleReal> data;
         data["s"] = ref_part.s;  // TODO: remove when the output gets rerouted to openPMD
@@ -0,0 +1,70 @@
+/* Copyright 2022-2023 The Regents of the University of California, through Lawrence
+ *           Berkeley National Laboratory (subject to receipt of any required
+ *           approvals from the U.S. Dept. of Energy). All rights reserved.
+ *
+ * This file is part of ImpactX.
+ *
+ * Authors: Axel Huebl
+ * License: BSD-3-Clause-LBNL
+ */
+#include "StagingBuffer.H"
+
+#include <AMReX_BLProfiler.H>
+#include <AMReX_GpuContainers.H>
+#include <AMReX_GpuDevice.H>
+
+
+namespace impactx::diagnostics
+{
+    StagingContainer &
+    StageParticles (
+        std::shared_ptr<StagingContainer> & staging_buffer,
+        ImpactXParticleContainer const & pc,
+        bool copy_aos,
+        std::vector<int> const & real_soa_comps
+    )
+    {
+        BL_PROFILE("impactx::diagnostics::StageParticles");
+
+        // (re)create the container if the particle layout or the runtime attributes changed
+        if (!staging_buffer || staging_buffer->GetParGDB() != pc.GetParGDB() ||
+            staging_buffer->NumRuntimeRealComps() != pc.NumRuntimeRealComps()) {
+            staging_buffer = std::make_shared<StagingContainer>(
+                pc.make_alike<amrex::PinnedArenaAllocator>());
+        }
+        StagingContainer & staging = *staging_buffer;
+        staging.resizeData();
+
+        // drop the particles of the last call, but keep the allocations
+        for (int lev = 0; lev < int(staging.GetParticles().size()); ++lev) {
+            for (auto & [index, ptile] : staging.GetParticles(lev)) {
+                ptile.resize(0);
+            }
+        }
+
+        for (int lev = 0; lev <= pc.finestLevel(); ++lev) {
+            for (auto const & [index, src] : pc.GetParticles(lev)) {
+                auto & dst = staging.DefineAndReturnParticleTile(lev, index.first, index.second);
+                dst.resize(src.numParticles());
+
+                // copy device-to-host
+                if (copy_aos) {
+                    auto const & src_aos = src.GetArrayOfStructs();
+                    amrex::Gpu::copyAsync(amrex::Gpu::deviceToHost,
+                                          src_aos.begin(), src_aos.end(),
+                                          dst.GetArrayOfStructs().begin());
+                }
+                for (int const comp : real_soa_comps) {
+                    auto const & src_comp = src.GetStructOfArrays().GetRealData(comp);
+                    amrex::Gpu::copyAsync(amrex::Gpu::deviceToHost,
+                                          src_comp.begin(), src_comp.end(),
+                                          dst.GetStructOfArrays().GetRealData(comp).begin());
+                }
+            }
+        }
+        amrex::Gpu::streamSynchronize();
+
+        return staging;
+    }
+
+} // namespace impactx::diagnostics
@@ -10,6 +10,7 @@
 
 #include "openPMD.H"
 #include "particles/ImpactXParticleContainer.H"
+#include "particles/diagnostics/StagingBuffer.H"
 
 #include <ablastr/particles/IndexHandling.H>
 
@@ -141,6 +142,9 @@ namespace detail
             m_series.reset();
         }
 
+        // pinned host memory of the staged particles
+        m_staging.reset();
+
         // remove from unique series map
         if (m_unique_series.count(m_series_name) != 0u)
             m_unique_series.erase(m_series_name);
@@ -276,6 +280,17 @@ namespace detail
                 auto const component_name = real_soa_names.at(real_idx);
                 getComponentRecord(component_name).resetDataset(d_fl);
             }
+
+            // attributes that are the same for all particles are written as constants
+            std::vector<std::string> real_uniform_names(RealUniform::names.size());
+            std::copy(RealUniform::names.begin(), RealUniform::names.end(), real_uniform_names.begin());
+            for (auto real_idx = 0; real_idx < RealUniform::nattribs; real_idx++) {
+                auto const component_name = real_uniform_names.at(real_idx);
+                getComponentRecord(component_name).resetDataset(d_fl);
+                if (m_uniform_real.at(real_idx).has_value()) {
+                    getComponentRecord(component_name).makeConstant(m_uniform_real.at(real_idx).value());
+                }
+            }
         }
         // SoA: Int
         static_assert(IntSoA::nattribs == 0); // not yet used
@@ -293,9 +308,18 @@ namespace detail
         // preparing to access reference particle data: RefPart
         RefPart & ref_part = pc.GetRefParticle();
 
-        // pinned memory copy
-        PinnedContainer pinned_pc = pc.make_alike<amrex::PinnedArenaAllocator>();
-        pinned_pc.copyParticles(pc, true);  // no filtering
+        // attributes that are the same for all particles are written as constants
+        for (auto real_idx = 0; real_idx < RealUniform::nattribs; real_idx++) {
+            m_uniform_real.at(real_idx) = pc.GetUniformRealAttribute(real_idx);
+            m_real_soa_index.at(real_idx) = pc.GetRealAttributeSoAIndex(real_idx);
+        }
+
+        // pinned memory copy of all attributes that are written per particle
+        std::vector<int> real_soa_comps = {RealSoA::px, RealSoA::py, RealSoA::pt};
+        for (auto const soa_index : m_real_soa_index) {
+            if (soa_index >= 0) { real_soa_comps.push_back(soa_index); }
+        }
+        PinnedContainer & pinned_pc = StageParticles(m_staging, pc, true, real_soa_comps);
 
         // TODO: filtering
         /*
@@ -411,6 +435,17 @@ namespace detail
                 getComponentRecord(component_name).storeChunkRaw(
                 soa.GetRealData(real_idx).data(), {offset}, {numParticleOnTile64});
             }
+
+            // attributes that vary between particles are stored in runtime components
+            std::vector<std::string> real_uniform_names(RealUniform::names.size());
+            std::copy(RealUniform::names.begin(), RealUniform::names.end(), real_uniform_names.begin());
+            for (auto real_idx=0; real_idx < RealUniform::nattribs; real_idx++) {
+                int const soa_index = m_real_soa_index.at(real_idx);
+                if (soa_index < 0) { continue; }
+                auto const component_name = real_uniform_names.at(real_idx);
+                getComponentRecord(component_name).storeChunkRaw(
+                soa.GetRealData(soa_index).data(), {offset}, {numParticleOnTile64});
+            }
         }
         //   SoA integer (int) properties (not yet used)
         {
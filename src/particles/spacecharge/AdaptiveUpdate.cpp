@@ -0,0 +1,136 @@
+/* Copyright 2022-2023 The Regents of the University of California, through Lawrence
+ *           Berkeley National Laboratory (subject to receipt of any required
+ *           approvals from the U.S. Dept. of Energy). All rights reserved.
+ *
+ * This file is part of ImpactX.
+ *
+ * Authors: Axel Huebl
+ * License: BSD-3-Clause-LBNL
+ */
+#include "AdaptiveUpdate.H"
+
+#include "particles/transformation/CoordinateTransformation.H"
+
+#include <AMReX_BLProfiler.H>
+#include <AMReX_Extension.H>
+#include <AMReX_GpuQualifiers.H>
+#include <AMReX_ParallelReduce.H>
+#include <AMReX_Reduce.H>
+
+#include <array>
+#include <cmath>
+#include <limits>
+
+
+namespace impactx::spacecharge
+{
+    BeamMoments
+    GetBeamMoments (ImpactXParticleContainer & pc, bool particles_at_fixed_s)
+    {
+        BL_PROFILE("impactx::spacecharge::GetBeamMoments");
+
+        auto const [x_mean, x_std, y_mean, y_std, z_mean, z_std] = particles_at_fixed_s ?
+            transformation::MeanAndStdPositionsFixedT(pc) :
+            pc.MeanAndStdPositions();
+
+        BeamMoments moments;
+        moments.mean = {x_mean, y_mean, z_mean};
+        moments.std = {x_std, y_std, z_std};
+        moments.beta_gamma = pc.GetRefParticle().beta_gamma();
+        moments.num_particles = pc.TotalNumberOfParticles(true, false);
+
+        return moments;
+    }
+
+    bool
+    NeedsFieldUpdate (
+        BeamMoments const & last,
+        BeamMoments const & current,
+        amrex::Geometry const & geom,
+        amrex::Real tolerance
+    )
+    {
+        if (current.num_particles != last.num_particles) { return true; }
+
+        if (std::abs(current.beta_gamma - last.beta_gamma) > tolerance * last.beta_gamma) { return true; }
+
+        for (int d = 0; d < 3; ++d) {
+            if (std::abs(current.std[d] - last.std[d]) > tolerance * last.std[d]) { return true; }
+            if (std::abs(current.mean[d] - last.mean[d]) > tolerance * geom.ProbLength(d)) { return true; }
+        }
+
+        return false;
+    }
+
+    bool
+    BeamFitsMesh (
+        ImpactXParticleContainer & pc,
+        amrex::Geometry const & geom,
+        bool particles_at_fixed_s
+    )
+    {
+        BL_PROFILE("impactx::spacecharge::BeamFitsMesh");
+
+        auto const [x_min, y_min, z_min, x_max, y_max, z_max] = particles_at_fixed_s ?
+            transformation::MinAndMaxPositionsFixedT(pc) :
+            pc.MinAndMaxPositions();
+
+        std::array<amrex::ParticleReal, 3> const lo = {x_min, y_min, z_min};
+        std::array<amrex::ParticleReal, 3> const hi = {x_max, y_max, z_max};
+        for (int d = 0; d < 3; ++d) {
+            if (lo[d] < geom.ProbLo(d) || hi[d] >= geom.ProbHi(d)) { return false; }
+        }
+
+        return true;
+    }
+
+    int
+    CellsOutsideOfBoxes (ImpactXParticleContainer const & pc)
+    {
+        BL_PROFILE("impactx::spacecharge::CellsOutsideOfBoxes");
+
+        // a particle further out than the size of its box needs a full Redistribute
+        int const lost = std::numeric_limits<int>::max();
+
+        amrex::ReduceOps<amrex::ReduceOpMax> reduce_op;
+        amrex::ReduceData<int> reduce_data(reduce_op);
+        using ReduceTuple = typename decltype(reduce_data)::Type;
+
+        using PType = ImpactXParticleContainer::ParticleType;
+        for (int lev = 0; lev <= pc.finestLevel(); ++lev) {
+            amrex::Geometry const & geom = pc.Geom(lev);
+            amrex::BoxArray const & ba = pc.ParticleBoxArray(lev);
+            auto const plo = geom.ProbLoArray();
+            auto const dxi = geom.InvCellSizeArray();
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#endif
+            for (ImpactXParticleContainer::const_iterator pti(pc, lev); pti.isValid(); ++pti) {
+                int const np = pti.numParticles();
+                PType const * const AMREX_RESTRICT aos_ptr = pti.GetArrayOfStructs()().dataPtr();
+                amrex::Box const box = ba[pti.index()];
+                amrex::IntVect const lo = box.smallEnd();
+                amrex::IntVect const hi = box.bigEnd();
+                amrex::IntVect const len = box.length();
+
+                reduce_op.eval(np, reduce_data, [=] AMREX_GPU_DEVICE (int i) -> ReduceTuple
+                {
+                    int cells = 0;
+                    for (int d = 0; d < AMREX_SPACEDIM; ++d) {
+                        // cell index relative to the lower end of the box, without overflow
+                        amrex::Real const rel = std::floor((aos_ptr[i].pos(d) - plo[d]) * dxi[d]) - lo[d];
+                        if (!(rel >= -len[d] && rel < 2 * len[d])) { return {lost}; }
+                        int const k = static_cast<int>(rel) + lo[d];
+                        cells = amrex::max(cells, amrex::max(lo[d] - k, k - hi[d]));
+                    }
+                    return {cells};
+                });
+            }
+        }
+
+        int cells = amrex::get<0>(reduce_data.value(reduce_op));
+        amrex::ParallelAllReduce::Max(cells, amrex::ParallelDescriptor::Communicator());
+        return cells == lost ? -1 : cells;
+    }
+} // namespace impactx::spacecharge
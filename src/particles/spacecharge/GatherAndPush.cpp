@@ -9,12 +9,18 @@
  */
 #include "GatherAndPush.H"
 
+#include "particles/ParallelForParticles.H"
+
+#include <ablastr/constant.H>
 #include <ablastr/particles/NodalFieldGather.H>
+#include <ablastr/utils/Communication.H>
 
 #include <AMReX_BLProfiler.H>
 #include <AMReX_REAL.H>       // for Real
 #include <AMReX_SPACE.H>      // for AMREX_D_DECL
 
+#include <stdexcept>
+
 
 namespace impactx::spacecharge
 {
@@ -31,6 +37,18 @@ namespace impactx::spacecharge
 
         amrex::ParticleReal const charge = pc.GetRefParticle().charge;
 
+        // physical constants and reference quantities
+        amrex::ParticleReal const c0_SI = ablastr::constant::SI::c;
+        amrex::ParticleReal const mc_SI = pc.GetRefParticle().mass * c0_SI;
+        amrex::ParticleReal const pz_ref_SI = pc.GetRefParticle().beta_gamma() * mc_SI;
+        amrex::ParticleReal const gamma = pc.GetRefParticle().gamma();
+        amrex::ParticleReal const inv_gamma2 = 1.0_prt / (gamma * gamma);
+
+        amrex::ParticleReal const dt = slice_ds / pc.GetRefParticle().beta() / c0_SI;
+
+        // group together constants for the momentum push
+        amrex::ParticleReal const push_consts = dt * charge * inv_gamma2 / pz_ref_SI;
+
         // loop over refinement levels
         int const nLevel = pc.finestLevel();
         for (int lev = 0; lev <= nLevel; ++lev)
@@ -41,27 +59,23 @@ namespace impactx::spacecharge
             amrex::GpuArray<amrex::Real, 3> const invdr{AMREX_D_DECL(1_rt/dr[0], 1_rt/dr[1], 1_rt/dr[2])};
             const auto prob_lo = gm.ProbLoArray();
 
+            // field components of this level
+            amrex::MultiFab const & scf_x = space_charge_field.at(lev).at("x");
+            amrex::MultiFab const & scf_y = space_charge_field.at(lev).at("y");
+            amrex::MultiFab const & scf_z = space_charge_field.at(lev).at("z");
+
             // loop over all particle boxes
             using ParIt = ImpactXParticleContainer::iterator;
 #ifdef AMREX_USE_OMP
-#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion() && ThreadOverTiles(pc, lev))
 #endif
             for (ParIt pti(pc, lev); pti.isValid(); ++pti) {
                 const int np = pti.numParticles();
 
                 // get the device pointer-wrapper Array4 for 3D field access
-                auto const scf_arr_x = space_charge_field.at(lev).at("x")[pti].array();
-                auto const scf_arr_y = space_charge_field.at(lev).at("y")[pti].array();
-                auto const scf_arr_z = space_charge_field.at(lev).at("z")[pti].array();
-
-                // physical constants and reference quantities
-                amrex::ParticleReal const c0_SI = 2.99792458e8;  // TODO move out
-                amrex::ParticleReal const mc_SI = pc.GetRefParticle().mass * c0_SI;
-                amrex::ParticleReal const pz_ref_SI = pc.GetRefParticle().beta_gamma() * mc_SI;
-                amrex::ParticleReal const gamma = pc.GetRefParticle().gamma();
-                amrex::ParticleReal const inv_gamma2 = 1.0_prt / (gamma * gamma);
-
-                amrex::ParticleReal const dt = slice_ds / pc.GetRefParticle().beta() / c0_SI;
+                auto const scf_arr_x = scf_x[pti].const_array();
+                auto const scf_arr_y = scf_y[pti].const_array();
+                auto const scf_arr_z = scf_z[pti].const_array();
 
                 // preparing access to particle data: AoS
                 using PType = ImpactXParticleContainer::ParticleType;
@@ -74,11 +88,8 @@ namespace impactx::spacecharge
                 amrex::ParticleReal* const AMREX_RESTRICT part_py = soa_real[RealSoA::py].dataPtr();
                 amrex::ParticleReal* const AMREX_RESTRICT part_pz = soa_real[RealSoA::pz].dataPtr(); // note: currently for a fixed t
 
-                // group together constants for the momentum push
-                amrex::ParticleReal const push_consts = dt * charge * inv_gamma2 / pz_ref_SI;
-
                 // gather to each particle and push momentum
-                amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) {
+                ParallelForParticles(np, [=] AMREX_GPU_DEVICE (int i) {
                     // access AoS data such as positions and cpu/id
                     PType const & AMREX_RESTRICT p = aos_ptr[i];
 
@@ -107,4 +118,121 @@ namespace impactx::spacecharge
             } // end loop over all particle boxes
         } // env mesh-refinement level loop
     }
+
+namespace detail
+{
+    /** Gather the gradient of the potential and push the particles of one tile
+     *
+     * @tparam depos_order the order of the particle shape
+     */
+    template <int depos_order>
+    void
+    gather_and_push_from_potential (
+        ParIter & pti,
+        amrex::Array4<amrex::Real const> const & phi_arr,
+        amrex::GpuArray<amrex::Real, 3> const & invdr,
+        amrex::GpuArray<amrex::Real, 3> const & prob_lo,
+        amrex::ParticleReal const push_consts
+    )
+    {
+        const int np = pti.numParticles();
+
+        // preparing access to particle data: AoS
+        using PType = ImpactXParticleContainer::ParticleType;
+        auto const & aos = pti.GetArrayOfStructs();
+        PType const * const AMREX_RESTRICT aos_ptr = aos().dataPtr();
+
+        // preparing access to particle data: SoA of Reals
+        auto& soa_real = pti.GetStructOfArrays().GetRealData();
+        amrex::ParticleReal* const AMREX_RESTRICT part_px = soa_real[RealSoA::px].dataPtr();
+        amrex::ParticleReal* const AMREX_RESTRICT part_py = soa_real[RealSoA::py].dataPtr();
+        amrex::ParticleReal* const AMREX_RESTRICT part_pz = soa_real[RealSoA::pz].dataPtr(); // note: currently for a fixed t
+
+        // gather to each particle and push momentum
+        ParallelForParticles(np, [=] AMREX_GPU_DEVICE (int i) {
+            // access AoS data such as positions and cpu/id
+            PType const & AMREX_RESTRICT p = aos_ptr[i];
+
+            // field -grad(phi) at the particle position
+            amrex::GpuArray<amrex::Real, 3> const field_interp =
+                FieldFromPotentialNodal<depos_order>(
+                    p.pos(RealAoS::x), p.pos(RealAoS::y), p.pos(RealAoS::t),
+                    phi_arr, invdr, prob_lo);
+
+            // push momentum
+            part_px[i] += field_interp[0] * push_consts;
+            part_py[i] += field_interp[1] * push_consts;
+            part_pz[i] += field_interp[2] * push_consts;
+
+            // push position is done in the lattice elements
+        });
+    }
+} // namespace detail
+
+    void GatherAndPushFromPotential (
+        ImpactXParticleContainer & pc,
+        std::unordered_map<int, amrex::MultiFab> & phi,
+        const amrex::Vector<amrex::Geometry>& geom,
+        amrex::ParticleReal const slice_ds,
+        bool mixed_precision_fields
+    )
+    {
+        BL_PROFILE("impactx::spacecharge::GatherAndPushFromPotential");
+
+        using namespace amrex::literals;
+
+        amrex::ParticleReal const charge = pc.GetRefParticle().charge;
+        int const particle_shape = pc.GetParticleShape();
+
+        // physical constants and reference quantities
+        amrex::ParticleReal const c0_SI = ablastr::constant::SI::c;
+        amrex::ParticleReal const mc_SI = pc.GetRefParticle().mass * c0_SI;
+        amrex::ParticleReal const pz_ref_SI = pc.GetRefParticle().beta_gamma() * mc_SI;
+        amrex::ParticleReal const gamma = pc.GetRefParticle().gamma();
+        amrex::ParticleReal const inv_gamma2 = 1.0_prt / (gamma * gamma);
+
+        amrex::ParticleReal const dt = slice_ds / pc.GetRefParticle().beta() / c0_SI;
+
+        // group together constants for the momentum push
+        amrex::ParticleReal const push_consts = dt * charge * inv_gamma2 / pz_ref_SI;
+
+        // loop over refinement levels
+        int const nLevel = pc.finestLevel();
+        for (int lev = 0; lev <= nLevel; ++lev)
+        {
+            // get simulation geometry information
+            auto const &gm = geom[lev];
+            auto const dr = gm.CellSizeArray();
+            amrex::GpuArray<amrex::Real, 3> const invdr{AMREX_D_DECL(1_rt/dr[0], 1_rt/dr[1], 1_rt/dr[2])};
+            const auto prob_lo = gm.ProbLoArray();
+
+            // the shape of particles close to a box boundary reaches into the guard cells
+            amrex::MultiFab & phi_at_level = phi.at(lev);
+            ablastr::utils::communication::FillBoundary(
+                phi_at_level, mixed_precision_fields, gm.periodicity());
+
+            // loop over all particle boxes
+            using ParIt = ImpactXParticleContainer::iterator;
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion() && ThreadOverTiles(pc, lev))
+#endif
+            for (ParIt pti(pc, lev); pti.isValid(); ++pti) {
+                auto const phi_arr = phi_at_level[pti].const_array();
+
+                switch (particle_shape) {
+                    case 1:
+                        detail::gather_and_push_from_potential<1>(pti, phi_arr, invdr, prob_lo, push_consts);
+                        break;
+                    case 2:
+                        detail::gather_and_push_from_potential<2>(pti, phi_arr, invdr, prob_lo, push_consts);
+                        break;
+                    case 3:
+                        detail::gather_and_push_from_potential<3>(pti, phi_arr, invdr, prob_lo, push_consts);
+                        break;
+                    default:
+                        throw std::runtime_error("GatherAndPushFromPotential: particle shape must be 1, 2 or 3");
+                }
+            } // end loop over all particle boxes
+        } // env mesh-refinement level loop
+    }
 } // namespace impactx::spacecharge
@@ -0,0 +1,337 @@
+/* Copyright 2022-2023 The Regents of the University of California, through Lawrence
+ *           Berkeley National Laboratory (subject to receipt of any required
+ *           approvals from the U.S. Dept. of Energy). All rights reserved.
+ *
+ * This file is part of ImpactX.
+ *
+ * Authors: Axel Huebl
+ * License: BSD-3-Clause-LBNL
+ */
+#include "HaloParticles.H"
+
+#include <ablastr/constant.H>
+
+#include <AMReX_BLProfiler.H>
+#include <AMReX_Extension.H>            // for AMREX_RESTRICT
+#include <AMReX_MFIter.H>
+#include <AMReX_GpuContainers.H>        // for Gpu::copyAsync
+#include <AMReX_GpuQualifiers.H>        // for AMREX_GPU_DEVICE
+#include <AMReX_ParallelDescriptor.H>   // for ParallelDescriptor
+#include <AMReX_ParallelReduce.H>       // for ParallelAllReduce
+#include <AMReX_ParticleReduce.H>       // for ParticleReduce
+#include <AMReX_ParticleTransformation.H> // for filterParticles, copyParticles
+#include <AMReX_Reduce.H>               // for ReduceOps
+
+#include <array>
+#include <cmath>
+#include <set>
+#include <utility>
+#include <vector>
+
+
+namespace impactx::spacecharge
+{
+namespace
+{
+    /** Send the halo particles of MPI ranks without grids to the MPI rank of the first box
+     *
+     * The particles are added to the first tile of the first box of the
+     * coarsest level in the halo container of that MPI rank.
+     *
+     * @param[in] pc container of the particles
+     * @param[inout] halo container of the halo particles
+     */
+    void
+    SendOrphanedHaloParticles (ImpactXParticleContainer const & pc, HaloContainer & halo)
+    {
+        using PType = HaloContainer::ParticleType;
+
+        bool has_grids = false;
+        for (int lev = 0; lev <= pc.finestLevel(); ++lev) {
+            has_grids = has_grids || pc.MakeMFIter(lev).isValid();
+        }
+        bool orphaned = !has_grids && halo.TotalNumberOfParticles(false, true) > 0;
+        amrex::ParallelAllReduce::Or(orphaned, amrex::ParallelDescriptor::Communicator());
+        if (!orphaned) { return; }
+
+        BL_PROFILE("impactx::spacecharge::SendOrphanedHaloParticles");
+
+        // host copy of the halo particles of this MPI rank, if it has no grids
+        amrex::Vector<PType> aos;
+        int const ncomp = RealSoA::nattribs + halo.NumRuntimeRealComps();
+        std::vector<amrex::Vector<amrex::ParticleReal>> soa(ncomp);
+        if (!has_grids) {
+            for (int lev = 0; lev <= halo.finestLevel(); ++lev) {
+                for (auto & [key, tile] : halo.GetParticles(lev)) {
+                    int const np = tile.numParticles();
+                    if (np == 0) { continue; }
+
+                    auto const old_np = aos.size();
+                    aos.resize(old_np + np);
+                    auto const & tile_aos = tile.GetArrayOfStructs()();
+                    amrex::Gpu::copyAsync(amrex::Gpu::deviceToHost, tile_aos.begin(), tile_aos.end(),
+                                          aos.begin() + old_np);
+                    for (int comp = 0; comp < ncomp; ++comp) {
+                        soa[comp].resize(old_np + np);
+                        auto const & tile_soa = tile.GetStructOfArrays().GetRealData(comp);
+                        amrex::Gpu::copyAsync(amrex::Gpu::deviceToHost, tile_soa.begin(), tile_soa.end(),
+                                              soa[comp].begin() + old_np);
+                    }
+                    amrex::Gpu::streamSynchronize();
+                    tile.resize(0);
+                }
+            }
+        }
+
+        // gather on the MPI rank of the first box
+        int const root = pc.ParticleDistributionMap(0)[0];
+        int const nprocs = amrex::ParallelDescriptor::NProcs();
+        int const np_send = static_cast<int>(aos.size());
+        std::vector<int> np_recv(nprocs, 0);
+        amrex::ParallelDescriptor::Gather(&np_send, 1, np_recv.data(), 1, root);
+
+        std::vector<int> np_disp(nprocs, 0);
+        std::vector<int> bytes_recv(nprocs, 0);
+        std::vector<int> bytes_disp(nprocs, 0);
+        for (int rank = 1; rank < nprocs; ++rank) {
+            np_disp[rank] = np_disp[rank - 1] + np_recv[rank - 1];
+        }
+        for (int rank = 0; rank < nprocs; ++rank) {
+            bytes_recv[rank] = np_recv[rank] * static_cast<int>(sizeof(PType));
+            bytes_disp[rank] = np_disp[rank] * static_cast<int>(sizeof(PType));
+        }
+        int const np_total = np_disp[nprocs - 1] + np_recv[nprocs - 1];
+
+        amrex::Vector<PType> aos_recv(np_total);
+        amrex::ParallelDescriptor::Gatherv(reinterpret_cast<char const *>(aos.data()),
+                                           np_send * static_cast<int>(sizeof(PType)),
+                                           reinterpret_cast<char *>(aos_recv.data()),
+                                           bytes_recv, bytes_disp, root);
+        std::vector<amrex::Vector<amrex::ParticleReal>> soa_recv(ncomp);
+        for (int comp = 0; comp < ncomp; ++comp) {
+            soa_recv[comp].resize(np_total);
+            amrex::ParallelDescriptor::Gatherv(soa[comp].data(), np_send, soa_recv[comp].data(),
+                                               np_recv, np_disp, root);
+        }
+
+        if (amrex::ParallelDescriptor::MyProc() != root || np_total == 0) { return; }
+
+        auto & dst = halo.DefineAndReturnParticleTile(0, 0, 0);
+        auto const old_np = dst.numParticles();
+        dst.resize(old_np + np_total);
+        auto & dst_aos = dst.GetArrayOfStructs()();
+        amrex::Gpu::copyAsync(amrex::Gpu::hostToDevice, aos_recv.begin(), aos_recv.end(),
+                              dst_aos.begin() + old_np);
+        for (int comp = 0; comp < ncomp; ++comp) {
+            auto & dst_soa = dst.GetStructOfArrays().GetRealData(comp);
+            amrex::Gpu::copyAsync(amrex::Gpu::hostToDevice, soa_recv[comp].begin(), soa_recv[comp].end(),
+                                  dst_soa.begin() + old_np);
+        }
+        amrex::Gpu::streamSynchronize();
+    }
+} // namespace
+
+    void
+    ExtractHaloParticles (ImpactXParticleContainer & pc, HaloContainer & halo)
+    {
+        BL_PROFILE("impactx::spacecharge::ExtractHaloParticles");
+
+        using PType = ImpactXParticleContainer::ParticleType;
+
+        // physical extent of the mesh
+        amrex::Geometry const & gm = pc.Geom(0);
+        auto const prob_lo = gm.ProbLoArray();
+        auto const prob_hi = gm.ProbHiArray();
+        auto const is_outside = [=] AMREX_GPU_HOST_DEVICE (PType const & p) noexcept {
+            bool outside = false;
+            for (int d = 0; d < AMREX_SPACEDIM; ++d) {
+                outside = outside || p.pos(d) < prob_lo[d] || p.pos(d) > prob_hi[d];
+            }
+            return outside;
+        };
+
+        halo.clearParticles();
+
+        // we loop over the particle tiles directly instead of over the
+        // boxes of the mesh, because the grids might have just changed
+        for (int lev = 0; lev <= pc.finestLevel(); ++lev) {
+            auto & particles_at_level = pc.GetParticles(lev);
+
+            std::vector<std::pair<int, int>> tile_keys;
+            for (auto const & kv : particles_at_level) {
+                if (kv.second.numParticles() > 0) {
+                    tile_keys.push_back(kv.first);
+                    halo.DefineAndReturnParticleTile(lev, kv.first.first, kv.first.second);
+                }
+            }
+            auto & halo_at_level = halo.GetParticles(lev);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel for schedule(dynamic) if (amrex::Gpu::notInLaunchRegion())
+#endif
+            for (int t = 0; t < static_cast<int>(tile_keys.size()); ++t) {
+                auto & src = particles_at_level.at(tile_keys[t]);
+                auto & dst = halo_at_level.at(tile_keys[t]);
+                int const np = src.numParticles();
+
+                // copy to the halo container, keeping the box and tile of each particle
+                dst.resize(np);
+                int const num_halo = amrex::filterParticles(
+                    dst, src,
+                    [=] AMREX_GPU_HOST_DEVICE (auto const & src_data, int i) noexcept {
+                        return is_outside(src_data.m_aos[i]);
+                    },
+                    0, 0, np);
+                dst.resize(num_halo);
+                if (num_halo == 0) { continue; }
+
+                // invalidate in the original container
+                PType * const AMREX_RESTRICT aos_ptr = src.GetArrayOfStructs()().dataPtr();
+                amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) {
+                    PType & p = aos_ptr[i];
+                    if (is_outside(p)) { p.id() = -p.id(); }
+                });
+            }
+        }
+    }
+
+    void
+    HaloPush (
+        ImpactXParticleContainer const & pc,
+        HaloContainer & halo,
+        amrex::ParticleReal slice_ds
+    )
+    {
+        BL_PROFILE("impactx::spacecharge::HaloPush");
+
+        using namespace amrex::literals;
+
+        // total weight and centroid of the beam core, accumulated in amrex::Real
+        using PTDType = ImpactXParticleContainer::ParticleTileType::ConstParticleTileDataType;
+        RealUniformAccessor const part_w = pc.GetRealAttribute(RealUniform::w);
+        amrex::ReduceOps<
+            amrex::ReduceOpSum, amrex::ReduceOpSum, amrex::ReduceOpSum, amrex::ReduceOpSum
+        > reduce_ops;
+        auto r = amrex::ParticleReduce<
+            amrex::ReduceData<
+                amrex::Real, amrex::Real, amrex::Real, amrex::Real
+            >
+        >(
+            pc,
+            [=] AMREX_GPU_DEVICE (const PTDType& ptd, const int i) noexcept
+            -> amrex::GpuTuple<
+                amrex::Real, amrex::Real, amrex::Real, amrex::Real
+            >
+            {
+                auto const & p = ptd.m_aos[i];
+                amrex::Real const p_w = part_w(ptd, i);
+                return {p_w, p.pos(RealAoS::x) * p_w, p.pos(RealAoS::y) * p_w, p.pos(RealAoS::z) * p_w};
+            },
+            reduce_ops
+        );
+
+        std::vector<amrex::Real> core_moments = {
+            amrex::get<0>(r), amrex::get<1>(r), amrex::get<2>(r), amrex::get<3>(r)
+        };
+        amrex::ParallelAllReduce::Sum(
+            core_moments.data(),
+            core_moments.size(),
+            amrex::ParallelDescriptor::Communicator()
+        );
+
+        amrex::Real const w_sum = core_moments[0];
+        if (w_sum == 0.0_rt) { return; }
+        amrex::ParticleReal const x_c = core_moments[1] / w_sum;
+        amrex::ParticleReal const y_c = core_moments[2] / w_sum;
+        amrex::ParticleReal const z_c = core_moments[3] / w_sum;
+
+        // physical constants and reference quantities, as in GatherAndPush
+        RefPart const ref_part = pc.GetRefParticle();
+        amrex::ParticleReal const charge = ref_part.charge;
+        amrex::ParticleReal const c0_SI = ablastr::constant::SI::c;
+        amrex::ParticleReal const mc_SI = ref_part.mass * c0_SI;
+        amrex::ParticleReal const pz_ref_SI = ref_part.beta_gamma() * mc_SI;
+        amrex::ParticleReal const gamma = ref_part.gamma();
+        amrex::ParticleReal const inv_gamma2 = 1.0_prt / (gamma * gamma);
+        amrex::ParticleReal const dt = slice_ds / ref_part.beta() / c0_SI;
+        amrex::ParticleReal const push_consts = dt * charge * inv_gamma2 / pz_ref_SI;
+
+        // potential of the co-moving core, solved with the same relativistic
+        // Poisson operator as the mesh: phi = gamma Q / (4 pi ep0 R') with
+        // R' = sqrt(x^2 + y^2 + gamma^2 z^2)
+        amrex::ParticleReal const core_charge = charge * w_sum;
+        amrex::ParticleReal const field_const =
+            gamma * core_charge / (4.0_prt * ablastr::constant::math::pi * ablastr::constant::SI::ep0);
+        amrex::ParticleReal const gamma2 = gamma * gamma;
+
+        using PType = HaloContainer::ParticleType;
+        for (int lev = 0; lev <= halo.finestLevel(); ++lev) {
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#endif
+            for (ParIter pti(halo, lev); pti.isValid(); ++pti) {
+                int const np = pti.numParticles();
+
+                PType const * const AMREX_RESTRICT aos_ptr = pti.GetArrayOfStructs()().dataPtr();
+                auto & soa_real = pti.GetStructOfArrays().GetRealData();
+                amrex::ParticleReal * const AMREX_RESTRICT part_px = soa_real[RealSoA::px].dataPtr();
+                amrex::ParticleReal * const AMREX_RESTRICT part_py = soa_real[RealSoA::py].dataPtr();
+                amrex::ParticleReal * const AMREX_RESTRICT part_pz = soa_real[RealSoA::pz].dataPtr();
+
+                amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) {
+                    PType const & p = aos_ptr[i];
+                    amrex::ParticleReal const dx = p.pos(RealAoS::x) - x_c;
+                    amrex::ParticleReal const dy = p.pos(RealAoS::y) - y_c;
+                    amrex::ParticleReal const dz = p.pos(RealAoS::z) - z_c;
+
+                    amrex::ParticleReal const r2 = dx * dx + dy * dy + gamma2 * dz * dz;
+                    amrex::ParticleReal const inv_r3 = 1.0_prt / (r2 * std::sqrt(r2));
+
+                    part_px[i] += field_const * dx * inv_r3 * push_consts;
+                    part_py[i] += field_const * dy * inv_r3 * push_consts;
+                    part_pz[i] += field_const * gamma2 * dz * inv_r3 * push_consts;
+                });
+            }
+        }
+    }
+
+    bool
+    RestoreHaloParticles (ImpactXParticleContainer & pc, HaloContainer & halo)
+    {
+        BL_PROFILE("impactx::spacecharge::RestoreHaloParticles");
+
+        SendOrphanedHaloParticles(pc, halo);
+
+        for (int lev = 0; lev <= pc.finestLevel(); ++lev) {
+            // particle tiles of the current grids on this MPI rank
+            std::set<std::pair<int, int>> local_tiles;
+            for (amrex::MFIter mfi = pc.MakeMFIter(lev); mfi.isValid(); ++mfi) {
+                local_tiles.insert({mfi.index(), mfi.LocalTileIndex()});
+            }
+
+            for (auto & [key, src] : halo.GetParticles(lev)) {
+                int const np = src.numParticles();
+                if (np == 0) { continue; }
+
+                // halo particles are outside of the mesh, so any local tile
+                // will do if the grids changed since the extraction
+                std::pair<int, int> dst_key = key;
+                if (local_tiles.count(key) == 0u) {
+                    AMREX_ALWAYS_ASSERT_WITH_MESSAGE(!local_tiles.empty(),
+                        "RestoreHaloParticles: no grid on this MPI rank to store halo particles");
+                    dst_key = *local_tiles.begin();
+                }
+
+                auto & dst = pc.DefineAndReturnParticleTile(lev, dst_key.first, dst_key.second);
+                auto const old_np = dst.numParticles();
+                dst.resize(old_np + np);
+                amrex::copyParticles(dst, src, 0, old_np, np);
+            }
+        }
+
+        amrex::Long const num_restored = halo.TotalNumberOfParticles(false, false);
+        halo.clearParticles();
+
+        return num_restored > 0;
+    }
+} // namespace impactx::spacecharge
@@ -0,0 +1,417 @@
+/* Copyright 2022-2023 The Regents of the University of California, through Lawrence
+ *           Berkeley National Laboratory (subject to receipt of any required
+ *           approvals from the U.S. Dept. of Energy). All rights reserved.
+ *
+ * This file is part of ImpactX.
+ *
+ * Authors: Axel Huebl
+ * License: BSD-3-Clause-LBNL
+ */
+#include "ParticleDecomposition.H"
+
+#include "GatherAndPush.H"
+#include "particles/ShapeFactors.H"
+
+#include <ablastr/constant.H>
+#include <ablastr/particles/NodalFieldGather.H>
+
+#include <AMReX_BLProfiler.H>
+#include <AMReX_Extension.H>  // for AMREX_RESTRICT
+#include <AMReX_FArrayBox.H>
+#include <AMReX_GpuAtomic.H>
+#include <AMReX_GpuContainers.H>
+#include <AMReX_iMultiFab.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_ParallelReduce.H>
+#include <AMReX_ParmParse.H>
+#include <AMReX_REAL.H>       // for Real
+#include <AMReX_SPACE.H>      // for AMREX_D_DECL
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+
+namespace impactx::spacecharge
+{
+namespace detail
+{
+    /** Sum a FAB over all MPI ranks
+     *
+     * @param fab the FAB to reduce, the same box on all ranks
+     * @param single_precision communicate in single precision
+     */
+    void
+    all_reduce_sum (amrex::FArrayBox & fab, bool single_precision)
+    {
+        BL_PROFILE("impactx::spacecharge::ParticleDecomposition::AllReduce");
+
+        auto const n = static_cast<int>(fab.size());
+        amrex::Real * const ptr = fab.dataPtr();
+        auto const comm = amrex::ParallelDescriptor::Communicator();
+
+#ifdef AMREX_USE_GPU
+        // reduce a host copy: MPI might not be GPU-aware
+        amrex::Gpu::PinnedVector<amrex::Real> host(n);
+        amrex::Gpu::copyAsync(amrex::Gpu::deviceToHost, ptr, ptr + n, host.begin());
+        amrex::Gpu::streamSynchronize();
+        amrex::Real * const host_ptr = host.data();
+#else
+        amrex::Real * const host_ptr = ptr;
+#endif
+
+        if (single_precision) {
+            std::vector<float> buffer(host_ptr, host_ptr + n);
+            amrex::ParallelAllReduce::Sum(buffer.data(), n, comm);
+            std::copy(buffer.begin(), buffer.end(), host_ptr);
+        } else {
+            amrex::ParallelAllReduce::Sum(host_ptr, n, comm);
+        }
+
+#ifdef AMREX_USE_GPU
+        amrex::Gpu::copyAsync(amrex::Gpu::hostToDevice, host.begin(), host.end(), ptr);
+        amrex::Gpu::streamSynchronize();
+#endif
+    }
+
+    /** Copy the boxes of nodal fields on all MPI ranks into one FAB of the full mesh
+     *
+     * Nodes that are shared between boxes are copied from their owner only.
+     * The guard cells outside of the domain can be part of several boxes:
+     * they are averaged over these boxes, which hold the same values.
+     *
+     * @param mfs one field per component of the result, all on the same mesh
+     * @param gm geometry of the mesh
+     * @param single_precision communicate in single precision
+     * @return the full mesh, including the guard cells of the fields
+     */
+    amrex::FArrayBox
+    replicate (
+        amrex::Vector<amrex::MultiFab const *> const & mfs,
+        amrex::Geometry const & gm,
+        bool single_precision
+    )
+    {
+        amrex::MultiFab const & mf0 = *mfs[0];
+        amrex::Box const domain = amrex::convert(gm.Domain(), mf0.ixType());
+        amrex::Box const box = amrex::grow(domain, mf0.nGrowVect());
+
+        // the last component counts the boxes that hold a guard cell outside of the domain
+        int const ncomp = static_cast<int>(mfs.size());
+        amrex::FArrayBox fab(box, ncomp + 1);
+        fab.setVal<amrex::RunOn::Device>(0.0);
+        auto const count = fab.array(ncomp);
+
+        for (int comp = 0; comp < ncomp; ++comp) {
+            amrex::MultiFab const & mf = *mfs[comp];
+            auto const owner_mask = mf.OwnerMask(gm.periodicity());
+            auto const dst = fab.array(comp);
+            for (amrex::MFIter mfi(mf); mfi.isValid(); ++mfi) {
+                auto const src = mf.const_array(mfi);
+                auto const mask = owner_mask->const_array(mfi);
+                amrex::ParallelFor(mfi.validbox(), [=] AMREX_GPU_DEVICE (int i, int j, int k) {
+                    if (mask(i, j, k)) { dst(i, j, k) = src(i, j, k); }
+                });
+
+                amrex::Box const guard_box = mfi.fabbox() & box;
+                amrex::ParallelFor(guard_box, [=] AMREX_GPU_DEVICE (int i, int j, int k) {
+                    if (!domain.contains(amrex::IntVect(i, j, k))) {
+                        dst(i, j, k) += src(i, j, k);
+                        if (comp == 0) { count(i, j, k) += 1.0; }
+                    }
+                });
+            }
+        }
+
+        all_reduce_sum(fab, single_precision);
+
+        auto const fab_arr = fab.array();
+        amrex::ParallelFor(box, [=] AMREX_GPU_DEVICE (int i, int j, int k) {
+            if (count(i, j, k) > 0.0) {
+                for (int comp = 0; comp < ncomp; ++comp) {
+                    fab_arr(i, j, k, comp) /= count(i, j, k);
+                }
+            }
+        });
+        return fab;
+    }
+
+    /** Deposit the charge of the particles of one tile to the full mesh
+     *
+     * @tparam depos_order the order of the particle shape
+     */
+    template <int depos_order>
+    void
+    deposit_tile_replicated (
+        ParIter & pti,
+        RealUniformAccessor const part_w,
+        amrex::FArrayBox & rho_fab,
+        amrex::ParticleReal const charge,
+        amrex::GpuArray<amrex::Real, 3> const & invdr,
+        amrex::GpuArray<amrex::Real, 3> const & prob_lo
+    )
+    {
+        const int np = pti.numParticles();
+
+        // preparing access to particle data
+        using PType = ImpactXParticleContainer::ParticleType;
+        PType const * const AMREX_RESTRICT aos_ptr = pti.GetArrayOfStructs()().dataPtr();
+        auto const ptd = pti.GetParticleTile().getConstParticleTileData();
+
+        auto const rho_arr = rho_fab.array();
+        amrex::Box const rho_box = rho_fab.box();
+        amrex::Real const invvol = invdr[0] * invdr[1] * invdr[2];
+
+        amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) {
+            PType const & p = aos_ptr[i];
+
+            amrex::Real sx[depos_order + 1], sy[depos_order + 1], sz[depos_order + 1];
+            int const i0 = ShapeFactor<depos_order>{}(sx, (p.pos(RealAoS::x) - prob_lo[0]) * invdr[0]);
+            int const j0 = ShapeFactor<depos_order>{}(sy, (p.pos(RealAoS::y) - prob_lo[1]) * invdr[1]);
+            int const k0 = ShapeFactor<depos_order>{}(sz, (p.pos(RealAoS::z) - prob_lo[2]) * invdr[2]);
+
+            // particles outside of the mesh and its guard cells are not deposited
+            if (!rho_box.contains(amrex::IntVect(i0, j0, k0)) ||
+                !rho_box.contains(amrex::IntVect(i0 + depos_order, j0 + depos_order, k0 + depos_order))) { return; }
+
+            amrex::Real const wq = charge * part_w(ptd, i) * invvol;
+            for (int kk = 0; kk <= depos_order; ++kk) {
+                for (int jj = 0; jj <= depos_order; ++jj) {
+                    for (int ii = 0; ii <= depos_order; ++ii) {
+                        amrex::HostDevice::Atomic::Add(
+                            &rho_arr(i0 + ii, j0 + jj, k0 + kk),
+                            sx[ii] * sy[jj] * sz[kk] * wq);
+                    }
+                }
+            }
+        });
+    }
+
+    /** Gather the field and push the particles of one tile in x,y,z
+     *
+     * @tparam F functor that returns the field in x,y,z at a position
+     */
+    template <typename F>
+    void
+    push_tile_replicated (
+        ParIter & pti,
+        F const & field_at,
+        amrex::ParticleReal const push_consts
+    )
+    {
+        const int np = pti.numParticles();
+
+        // preparing access to particle data
+        using PType = ImpactXParticleContainer::ParticleType;
+        PType const * const AMREX_RESTRICT aos_ptr = pti.GetArrayOfStructs()().dataPtr();
+        auto & soa_real = pti.GetStructOfArrays().GetRealData();
+        amrex::ParticleReal * const AMREX_RESTRICT part_px = soa_real[RealSoA::px].dataPtr();
+        amrex::ParticleReal * const AMREX_RESTRICT part_py = soa_real[RealSoA::py].dataPtr();
+        amrex::ParticleReal * const AMREX_RESTRICT part_pz = soa_real[RealSoA::pz].dataPtr();
+
+        amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) {
+            PType const & p = aos_ptr[i];
+
+            // gather and push momentum
+            amrex::GpuArray<amrex::Real, 3> const field_interp =
+                field_at(p.pos(RealAoS::x), p.pos(RealAoS::y), p.pos(RealAoS::z));
+            part_px[i] += field_interp[0] * push_consts;
+            part_py[i] += field_interp[1] * push_consts;
+            part_pz[i] += field_interp[2] * push_consts;
+
+            // push position is done in the lattice elements
+        });
+    }
+} // namespace detail
+
+    bool
+    ParticleDecomposition ()
+    {
+        std::string decomposition = "spatial";
+        amrex::ParmParse("algo").queryAdd("decomposition", decomposition);
+        if (decomposition != "spatial" && decomposition != "particle")
+            throw std::runtime_error("algo.decomposition must be spatial or particle but is: " + decomposition);
+        return decomposition == "particle";
+    }
+
+    void
+    CheckParticleDecomposition (ImpactXParticleContainer const & pc)
+    {
+        if (pc.GetParGDB()->maxLevel() > 0)
+            throw std::runtime_error("algo.decomposition = particle supports only a single refinement level");
+
+        bool dynamic_n_cell = false;
+        amrex::ParmParse("amr").query("dynamic_n_cell", dynamic_n_cell);
+        if (dynamic_n_cell)
+            throw std::runtime_error("algo.decomposition = particle does not yet support amr.dynamic_n_cell");
+
+        int has_box = 0;
+        for (amrex::MFIter mfi = pc.MakeMFIter(0); mfi.isValid(); ++mfi) {
+            has_box = 1;
+            break;
+        }
+        amrex::ParallelDescriptor::ReduceIntMin(has_box);
+        if (has_box == 0)
+            throw std::runtime_error("algo.decomposition = particle needs at least one box of the mesh per MPI process");
+    }
+
+    void
+    DepositChargeReplicated (
+        ImpactXParticleContainer & pc,
+        std::unordered_map<int, amrex::MultiFab> & rho,
+        bool const mixed_precision_fields
+    )
+    {
+        BL_PROFILE("impactx::spacecharge::DepositChargeReplicated");
+
+        using namespace amrex::literals;
+
+        amrex::ParticleReal const charge = pc.GetRefParticle().charge;
+        int const particle_shape = pc.GetParticleShape();
+
+        // loop over refinement levels
+        int const nLevel = pc.finestLevel();
+        for (int lev = 0; lev <= nLevel; ++lev)
+        {
+            amrex::MultiFab & rho_at_level = rho.at(lev);
+
+            // get simulation geometry information
+            auto const & gm = pc.Geom(lev);
+            auto const dr = gm.CellSizeArray();
+            amrex::GpuArray<amrex::Real, 3> const invdr{AMREX_D_DECL(1_rt/dr[0], 1_rt/dr[1], 1_rt/dr[2])};
+            const auto prob_lo = gm.ProbLoArray();
+
+            // local copy of the full mesh, including guard cells
+            amrex::Box const box = amrex::grow(
+                amrex::convert(gm.Domain(), rho_at_level.ixType()), rho_at_level.nGrowVect());
+            amrex::FArrayBox rho_fab(box, rho_at_level.nComp());
+            rho_fab.setVal<amrex::RunOn::Device>(0.0);
+            RealUniformAccessor const part_w = pc.GetRealAttribute(RealUniform::w);
+
+            // all tiles deposit to the same FAB: this uses atomics
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#endif
+            for (ParIter pti(pc, lev); pti.isValid(); ++pti) {
+                switch (particle_shape) {
+                    case 1:
+                        detail::deposit_tile_replicated<1>(pti, part_w, rho_fab, charge, invdr, prob_lo);
+                        break;
+                    case 2:
+                        detail::deposit_tile_replicated<2>(pti, part_w, rho_fab, charge, invdr, prob_lo);
+                        break;
+                    case 3:
+                        detail::deposit_tile_replicated<3>(pti, part_w, rho_fab, charge, invdr, prob_lo);
+                        break;
+                    default:
+                        throw std::runtime_error("DepositChargeReplicated: particle shape must be 1, 2 or 3");
+                }
+            }
+
+            // sum the contributions of all MPI ranks
+            detail::all_reduce_sum(rho_fab, mixed_precision_fields);
+
+            // copy the boxes of this MPI rank
+            //   as for the spatial decomposition, charge deposited outside of
+            //   the domain is dropped
+            rho_at_level.setVal(0.);
+            for (amrex::MFIter mfi(rho_at_level); mfi.isValid(); ++mfi) {
+                rho_at_level[mfi].copy<amrex::RunOn::Device>(rho_fab, mfi.validbox());
+            }
+        }
+    }
+
+    void
+    GatherAndPushReplicated (
+        ImpactXParticleContainer & pc,
+        std::unordered_map<int, std::unordered_map<std::string, amrex::MultiFab> > const & space_charge_field,
+        std::unordered_map<int, amrex::MultiFab> const & phi,
+        amrex::Vector<amrex::Geometry> const & geom,
+        amrex::ParticleReal const slice_ds,
+        bool const from_potential,
+        bool const mixed_precision_fields
+    )
+    {
+        BL_PROFILE("impactx::spacecharge::GatherAndPushReplicated");
+
+        using namespace amrex::literals;
+
+        amrex::ParticleReal const charge = pc.GetRefParticle().charge;
+        int const particle_shape = pc.GetParticleShape();
+
+        // physical constants and reference quantities
+        amrex::ParticleReal const c0_SI = ablastr::constant::SI::c;
+        amrex::ParticleReal const mc_SI = pc.GetRefParticle().mass * c0_SI;
+        amrex::ParticleReal const pz_ref_SI = pc.GetRefParticle().beta_gamma() * mc_SI;
+        amrex::ParticleReal const gamma = pc.GetRefParticle().gamma();
+        amrex::ParticleReal const inv_gamma2 = 1.0_prt / (gamma * gamma);
+
+        amrex::ParticleReal const dt = slice_ds / pc.GetRefParticle().beta() / c0_SI;
+
+        // group together constants for the momentum push
+        amrex::ParticleReal const push_consts = dt * charge * inv_gamma2 / pz_ref_SI;
+
+        // loop over refinement levels
+        int const nLevel = pc.finestLevel();
+        for (int lev = 0; lev <= nLevel; ++lev)
+        {
+            // get simulation geometry information
+            auto const & gm = geom[lev];
+            auto const dr = gm.CellSizeArray();
+            amrex::GpuArray<amrex::Real, 3> const invdr{AMREX_D_DECL(1_rt/dr[0], 1_rt/dr[1], 1_rt/dr[2])};
+            const auto prob_lo = gm.ProbLoArray();
+
+            // full copy of the fields on every MPI rank
+            amrex::Vector<amrex::MultiFab const *> fields;
+            if (from_potential) {
+                fields.push_back(&phi.at(lev));
+            } else {
+                for (std::string const comp : {"x", "y", "z"}) {
+                    fields.push_back(&space_charge_field.at(lev).at(comp));
+                }
+            }
+            amrex::FArrayBox const field_fab = detail::replicate(fields, gm, mixed_precision_fields);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#endif
+            for (ParIter pti(pc, lev); pti.isValid(); ++pti) {
+                if (from_potential) {
+                    auto const phi_arr = field_fab.const_array();
+                    switch (particle_shape) {
+                        case 1:
+                            detail::push_tile_replicated(pti,
+                                [=] AMREX_GPU_DEVICE (amrex::ParticleReal x, amrex::ParticleReal y, amrex::ParticleReal z) {
+                                    return FieldFromPotentialNodal<1>(x, y, z, phi_arr, invdr, prob_lo);
+                                }, push_consts);
+                            break;
+                        case 2:
+                            detail::push_tile_replicated(pti,
+                                [=] AMREX_GPU_DEVICE (amrex::ParticleReal x, amrex::ParticleReal y, amrex::ParticleReal z) {
+                                    return FieldFromPotentialNodal<2>(x, y, z, phi_arr, invdr, prob_lo);
+                                }, push_consts);
+                            break;
+                        case 3:
+                            detail::push_tile_replicated(pti,
+                                [=] AMREX_GPU_DEVICE (amrex::ParticleReal x, amrex::ParticleReal y, amrex::ParticleReal z) {
+                                    return FieldFromPotentialNodal<3>(x, y, z, phi_arr, invdr, prob_lo);
+                                }, push_consts);
+                            break;
+                        default:
+                            throw std::runtime_error("GatherAndPushReplicated: particle shape must be 1, 2 or 3");
+                    }
+                } else {
+                    // TODO: This is currently using linear order.
+                    auto const scf_arr_x = field_fab.const_array(0);
+                    auto const scf_arr_y = field_fab.const_array(1);
+                    auto const scf_arr_z = field_fab.const_array(2);
+                    detail::push_tile_replicated(pti,
+                        [=] AMREX_GPU_DEVICE (amrex::ParticleReal x, amrex::ParticleReal y, amrex::ParticleReal z) {
+                            return ablastr::particles::doGatherVectorFieldNodal(
+                                x, y, z, scf_arr_x, scf_arr_y, scf_arr_z, invdr, prob_lo);
+                        }, push_consts);
+                }
+            }
+        }
+    }
+} // namespace impactx::spacecharge
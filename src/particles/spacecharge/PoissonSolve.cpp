@@ -9,34 +9,117 @@
  */
 #include "PoissonSolve.H"
 
+#include <ablastr/constant.H>
 #include <ablastr/fields/PoissonSolver.H>
+#include <ablastr/utils/Communication.H>
+#include <ablastr/warn_manager/WarnManager.H>
 
+#include <AMReX.H>            // for ExecOnFinalize
 #include <AMReX_BLProfiler.H>
 #include <AMReX_Extension.H>  // for AMREX_RESTRICT
 #include <AMReX_LO_BCTYPES.H>
+#include <AMReX_MLMG.H>
+#include <AMReX_MLNodeTensorLaplacian.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_ParmParse.H>
 #include <AMReX_REAL.H>       // for ParticleReal
 
 #include <cmath>
+#include <memory>
 
 
 namespace impactx::spacecharge
 {
-    void PoissonSolve (
+namespace
+{
+    /** Linear operator and MLMG solver of one refinement level
+     *
+     * Both only need to be rebuilt if the index space of the grids or the
+     * reference energy change. The operator does not depend on the position
+     * of the mesh, so a mesh that is shifted in whole cells can be reused.
+     * A mesh whose cell size is scaled by the same factor in all directions
+     * is reused, too: the operator then only scales with the inverse square
+     * of that factor, which is applied to the right-hand side instead.
+     */
+    struct CachedSolver
+    {
+        amrex::Box m_domain;
+        amrex::GpuArray<amrex::Real, AMREX_SPACEDIM> m_cell_size;
+        amrex::BoxArray m_ba;
+        amrex::DistributionMapping m_dm;
+        amrex::Real m_beta_s = 0.0;
+
+        std::unique_ptr<amrex::MLNodeTensorLaplacian> m_linop;
+        std::unique_ptr<amrex::MLMG> m_mlmg; // references m_linop, thus declared after it
+
+        /** Check if the solver can be used for a mesh
+         *
+         * @param[in] geom geometry of the mesh
+         * @param[in] ba box array of the mesh (cell-centered)
+         * @param[in] dm distribution mapping of the mesh
+         * @param[in] beta_s relativistic beta of the reference particle
+         * @param[out] rhs_scale factor for the right-hand side of the cached operator
+         * @return true if the solver can be reused
+         */
+        bool
+        matches (
+            amrex::Geometry const & geom,
+            amrex::BoxArray const & ba,
+            amrex::DistributionMapping const & dm,
+            amrex::Real beta_s,
+            amrex::Real & rhs_scale
+        ) const
+        {
+            // relative tolerance on the ratio of the cell sizes
+            amrex::Real const rel_tol = 1.e-10;
+
+            if (m_domain != geom.Domain() || m_beta_s != beta_s) { return false; }
+            if (!(m_ba == ba && m_dm == dm)) { return false; }
+
+            amrex::Real const scale = geom.CellSize(0) / m_cell_size[0];
+            for (int d = 1; d < AMREX_SPACEDIM; ++d) {
+                if (std::abs(geom.CellSize(d) / m_cell_size[d] - scale) > rel_tol * scale) { return false; }
+            }
+            rhs_scale = scale * scale;
+            return true;
+        }
+    };
+
+    /** Solvers per refinement level
+     *
+     * The AMReX objects in here must be released before AMReX is finalized.
+     */
+    std::unordered_map<int, CachedSolver> &
+    solver_cache ()
+    {
+        static std::unordered_map<int, CachedSolver> cache;
+        static bool clear_on_finalize = false;
+        if (!clear_on_finalize) {
+            amrex::ExecOnFinalize([]() {
+                cache.clear();
+                clear_on_finalize = false;
+            });
+            clear_on_finalize = true;
+        }
+        return cache;
+    }
+} // namespace
+
+    amrex::Vector<PoissonSolveStats>
+    PoissonSolve (
         ImpactXParticleContainer const & pc,
         std::unordered_map<int, amrex::MultiFab> & rho,
-        std::unordered_map<int, amrex::MultiFab> & phi
+        std::unordered_map<int, amrex::MultiFab> & phi,
+        amrex::Vector<amrex::Geometry> const & geom,
+        amrex::Vector<amrex::BoxArray> const & ba,
+        amrex::Vector<amrex::DistributionMapping> const & dm,
+        amrex::Vector<amrex::IntVect> const & rel_ref_ratio,
+        bool mixed_precision_fields
     )
     {
-        using namespace amrex::literals;
+        BL_PROFILE("impactx::spacecharge::PoissonSolve");
 
-        // set space charge field to zero
-        //   loop over refinement levels
-        int const finest_level = phi.size() - 1u;
-        for (int lev = 0; lev <= finest_level; ++lev) {
-            amrex::MultiFab &phi_at_level = phi.at(lev);
-            // reset the values in phi to zero
-            phi_at_level.setVal(0.);
-        }
+        using namespace amrex::literals;
 
         // prepare parameters of the MLMG Poisson Solver
         //   relativistic beta=v/c of the reference particle
@@ -47,70 +130,144 @@ namespace impactx::spacecharge
         // of the reference particle.
         // After every T-to-Z transformation, Z aligns with the tangential vector of our reference
         // particle.
-        std::array<amrex::Real, 3> const beta_xyz = {0.0, 0.0, beta_s};
-
-        amrex::Real const mlmg_relative_tolerance = 1.e-7; // relative TODO: make smaller for SP
-        amrex::Real const mlmg_absolute_tolerance = 0.0;   // ignored
-
-        int const mlmg_max_iters = 100;
-        int const mlmg_verbosity = 1;
-
-        struct PoissonBoundaryHandler {
-            amrex::Array<amrex::LinOpBCType, AMREX_SPACEDIM> const lobc = {
-                amrex::LinOpBCType::Dirichlet,
-                amrex::LinOpBCType::Dirichlet,
-                amrex::LinOpBCType::Dirichlet
-            };
-            amrex::Array<amrex::LinOpBCType, AMREX_SPACEDIM> const hibc = {
-                amrex::LinOpBCType::Dirichlet,
-                amrex::LinOpBCType::Dirichlet,
-                amrex::LinOpBCType::Dirichlet
-            };
-            //bool bcs_set = false;
-            //std::array<bool, AMREX_SPACEDIM * 2> dirichlet_flag;
-            //bool has_non_periodic = false;
-        } poisson_boundary_handler;
-
-        // create a vector to our fields, sorted by level
-        amrex::Vector<amrex::MultiFab*> sorted_rho;
-        amrex::Vector<amrex::MultiFab*> sorted_phi;
+        amrex::Array<amrex::Real, AMREX_SPACEDIM> const beta_solver = {0.0, 0.0, beta_s};
+
+        amrex::ParmParse pp_algo("algo");
+        amrex::Real mlmg_relative_tolerance = 1.e-7;
+        amrex::Real mlmg_absolute_tolerance = 0.0;   // ignored if zero
+        int mlmg_max_iters = 100;
+        int mlmg_verbosity = 1;
+        pp_algo.queryAdd("mlmg_relative_tolerance", mlmg_relative_tolerance);
+        pp_algo.queryAdd("mlmg_absolute_tolerance", mlmg_absolute_tolerance);
+        pp_algo.queryAdd("mlmg_max_iters", mlmg_max_iters);
+        pp_algo.queryAdd("mlmg_verbosity", mlmg_verbosity);
+
+        amrex::Array<amrex::LinOpBCType, AMREX_SPACEDIM> const lobc = {
+            amrex::LinOpBCType::Dirichlet,
+            amrex::LinOpBCType::Dirichlet,
+            amrex::LinOpBCType::Dirichlet
+        };
+        amrex::Array<amrex::LinOpBCType, AMREX_SPACEDIM> const hibc = {
+            amrex::LinOpBCType::Dirichlet,
+            amrex::LinOpBCType::Dirichlet,
+            amrex::LinOpBCType::Dirichlet
+        };
+
+        // scale rho to the right-hand side of the Poisson equation and
+        // check if it is zero everywhere
+        int const finest_level = phi.size() - 1u;
+        amrex::Real max_norm_b = 0.0;
+        for (int lev = 0; lev <= finest_level; ++lev) {
+            rho.at(lev).mult(-1._rt / ablastr::constant::SI::ep0);
+            max_norm_b = amrex::max(max_norm_b, rho.at(lev).norm0());
+        }
+        amrex::ParallelDescriptor::ReduceRealMax(max_norm_b);
 
+        bool const always_use_bnorm = max_norm_b > 0.0_rt;
+        if (!always_use_bnorm) {
+            if (mlmg_absolute_tolerance == 0.0_rt) { mlmg_absolute_tolerance = 1.e-6_rt; }
+            ablastr::warn_manager::WMRecordWarning(
+                "ImpactX::spacecharge::PoissonSolve",
+                "Max norm of rho is 0",
+                ablastr::warn_manager::WarnPriority::low
+            );
+        }
+
+        amrex::Vector<PoissonSolveStats> stats(finest_level + 1);
+        auto & cache = solver_cache();
         for (int lev = 0; lev <= finest_level; ++lev) {
-            sorted_rho.emplace_back(&rho[lev]);
-            sorted_phi.emplace_back(&phi[lev]);
+            amrex::MultiFab & phi_at_level = phi.at(lev);
+
+            // (re)build the linear operator and solver if the mesh changed
+            amrex::Real rhs_scale = 1.0_rt;
+            auto it = cache.find(lev);
+            if (it == cache.end() || !it->second.matches(geom[lev], ba[lev], dm[lev], beta_s, rhs_scale)) {
+                rhs_scale = 1.0_rt;
+                BL_PROFILE("impactx::spacecharge::PoissonSolve::setup");
+
+                CachedSolver solver;
+                solver.m_domain = geom[lev].Domain();
+                solver.m_cell_size = geom[lev].CellSizeArray();
+                solver.m_ba = ba[lev];
+                solver.m_dm = dm[lev];
+                solver.m_beta_s = beta_s;
+
+                amrex::LPInfo const info;
+                solver.m_linop = std::make_unique<amrex::MLNodeTensorLaplacian>(
+                    amrex::Vector<amrex::Geometry>{geom[lev]},
+                    amrex::Vector<amrex::BoxArray>{ba[lev]},
+                    amrex::Vector<amrex::DistributionMapping>{dm[lev]},
+                    info
+                );
+                solver.m_linop->setBeta(beta_solver);
+                solver.m_linop->setDomainBC(lobc, hibc);
+                solver.m_mlmg = std::make_unique<amrex::MLMG>(*solver.m_linop);
+
+                it = cache.insert_or_assign(lev, std::move(solver)).first;
+            }
+
+            // the operator of the cached mesh is scaled to the current cell size
+            if (rhs_scale != 1.0_rt) { rho.at(lev).mult(rhs_scale); }
+
+            // solve, using the current values in phi as the initial guess
+            amrex::MLMG & mlmg = *it->second.m_mlmg;
+            mlmg.setVerbose(mlmg_verbosity);
+            mlmg.setMaxIter(mlmg_max_iters);
+            mlmg.setAlwaysUseBNorm(always_use_bnorm);
+            mlmg.solve(
+                amrex::Vector<amrex::MultiFab*>{&phi_at_level},
+                amrex::Vector<amrex::MultiFab const*>{&rho.at(lev)},
+                mlmg_relative_tolerance,
+                mlmg_absolute_tolerance * rhs_scale
+            );
+
+            stats[lev].num_iters = mlmg.getNumIters();
+            stats[lev].initial_residual = mlmg.getInitResidual() / rhs_scale;
+            stats[lev].final_residual = mlmg.getFinalResidual() / rhs_scale;
+
+            // the coarser level provides the boundary values and the initial
+            // guess for the finer level patch
+            //   The guard cells of the patch are filled, too: they are not
+            //   touched by the solve and are used by the field gather of the
+            //   particles at the edge of the patch.
+            if (lev < finest_level) {
+                amrex::MultiFab & phi_fine = phi.at(lev + 1);
+                amrex::IntVect const & refratio = rel_ref_ratio[lev];
+                amrex::BoxArray cba = phi_fine.boxArray();
+                cba.coarsen(refratio);
+
+                // coarse guard cells needed to interpolate to all fine guard cells
+                amrex::IntVect const ng_cp = (phi_fine.nGrowVect() + refratio - 1) / refratio + 1;
+                amrex::MultiFab phi_cp(cba, phi_fine.DistributionMap(), 1, ng_cp);
+                phi_cp.setVal(0.);
+                amrex::IntVect const ng = amrex::IntVect::TheUnitVector();
+                phi_cp.ParallelCopy(phi_at_level, 0, 0, 1, ng, ng_cp, geom[lev].periodicity());
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#endif
+                for (amrex::MFIter mfi(phi_fine, amrex::TilingIfNotGPU()); mfi.isValid(); ++mfi) {
+                    amrex::Array4<amrex::Real> const phi_fp_arr = phi_fine.array(mfi);
+                    amrex::Array4<amrex::Real const> const phi_cp_arr = phi_cp.const_array(mfi);
+                    ablastr::fields::details::PoissonInterpCPtoFP const interp(phi_fp_arr, phi_cp_arr, refratio);
+                    amrex::Box const b = mfi.growntilebox();
+                    amrex::ParallelFor(b, interp);
+                }
+            }
         }
 
-        ablastr::fields::computePhi(
-            sorted_rho,
-            sorted_phi,
-            beta_xyz,
-            mlmg_relative_tolerance,
-            mlmg_absolute_tolerance,
-            mlmg_max_iters,
-            mlmg_verbosity,
-            pc.GetParGDB()->Geom(),
-            pc.GetParGDB()->DistributionMap(),
-            pc.GetParGDB()->boxArray(),
-            poisson_boundary_handler
-            /*
-            do_single_precision_comms,
-            this->ref_ratio,
-            post_phi_calculation,
-            gett_new(0),
-            eb_farray_box_factory
-            */
-        );
-
-        // fix side effect on rho from previous call
-        for (int lev=0; lev<=finest_level; lev++) {
-            rho[lev].mult(-1._rt * PhysConst::ep0);
+        // restore rho
+        for (int lev = 0; lev <= finest_level; ++lev) {
+            rho.at(lev).mult(-1._rt * ablastr::constant::SI::ep0);
         }
 
         // fill boundary
-        for (int lev=0; lev<=finest_level; lev++)
-        {
-            amrex::MultiFab & phi_at_level = phi.at(lev);
-            phi_at_level.FillBoundary(pc.GetParGDB()->Geom()[lev].periodicity());
+        for (int lev = 0; lev <= finest_level; ++lev) {
+            BL_PROFILE("impactx::spacecharge::PoissonSolve::FillBoundary");
+            ablastr::utils::communication::FillBoundary(
+                phi.at(lev), mixed_precision_fields, geom[lev].periodicity());
         }
+
+        return stats;
     }
 } // impactx::spacecharge
@@ -0,0 +1,385 @@
+/* Copyright 2022-2023 The Regents of the University of California, through Lawrence
+ *           Berkeley National Laboratory (subject to receipt of any required
+ *           approvals from the U.S. Dept. of Energy). All rights reserved.
+ *
+ * This file is part of ImpactX.
+ *
+ * Authors: Axel Huebl
+ * License: BSD-3-Clause-LBNL
+ */
+#include "PoissonSolve2p5D.H"
+
+#include <ablastr/constant.H>
+#include <ablastr/warn_manager/WarnManager.H>
+
+#include <AMReX_BLProfiler.H>
+#include <AMReX_Extension.H>  // for AMREX_RESTRICT
+#include <AMReX_GpuAtomic.H>
+#include <AMReX_GpuContainers.H>
+#include <AMReX_iMultiFab.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_ParallelReduce.H>
+#include <AMReX_REAL.H>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace impactx::spacecharge
+{
+namespace
+{
+    /** Apply the negative transverse Laplacian -Laplace_perp on the inner nodes of a 2D grid
+     *
+     * @param[in] u input, flattened as i + j*nx
+     * @param[out] Au result on the inner nodes, flattened as i + j*nx
+     * @param[in] nx number of nodes in x
+     * @param[in] ny number of nodes in y
+     * @param[in] dx node spacing in x (m)
+     * @param[in] dy node spacing in y (m)
+     */
+    template<typename T>
+    void
+    apply_transverse_laplacian (
+        std::vector<T> const & u,
+        std::vector<T> & Au,
+        int nx,
+        int ny,
+        T dx,
+        T dy
+    )
+    {
+        T const cx = T(1) / (dx * dx);
+        T const cy = T(1) / (dy * dy);
+        auto const idx = [nx] (int i, int j) { return i + j * nx; };
+
+        for (int j = 1; j < ny - 1; ++j) {
+            for (int i = 1; i < nx - 1; ++i) {
+                T const u0 = u[idx(i, j)];
+                Au[idx(i, j)] = cx * (T(2) * u0 - u[idx(i-1, j)] - u[idx(i+1, j)])
+                              + cy * (T(2) * u0 - u[idx(i, j-1)] - u[idx(i, j+1)]);
+            }
+        }
+    }
+
+    /** Solve the transverse Poisson equation -Laplace_perp(psi) = rhs
+     *
+     * This uses a conjugate gradient method on the nodes of a 2D grid,
+     * with psi = 0 on the outermost nodes (Dirichlet boundaries).
+     *
+     * @param[in] rhs right-hand side, flattened as i + j*nx
+     * @param[out] psi solution, flattened as i + j*nx
+     * @param[in] nx number of nodes in x
+     * @param[in] ny number of nodes in y
+     * @param[in] dx node spacing in x (m)
+     * @param[in] dy node spacing in y (m)
+     * @param[in] rel_tol relative tolerance on the residual norm
+     * @param[in] max_iters maximum number of iterations
+     * @return convergence information
+     *
+     * @tparam T floating point type of the vectors and the iteration
+     */
+    template<typename T>
+    PoissonSolveStats
+    solve_transverse_poisson (
+        std::vector<T> const & rhs,
+        std::vector<T> & psi,
+        int nx,
+        int ny,
+        T dx,
+        T dy,
+        T rel_tol,
+        int max_iters
+    )
+    {
+        auto const idx = [nx] (int i, int j) { return i + j * nx; };
+
+        auto const apply_operator = [&] (std::vector<T> const & u, std::vector<T> & Au) {
+            apply_transverse_laplacian(u, Au, nx, ny, dx, dy);
+        };
+        auto const dot = [&] (std::vector<T> const & a, std::vector<T> const & b) {
+            T s = 0;
+            for (int j = 1; j < ny - 1; ++j) {
+                for (int i = 1; i < nx - 1; ++i) {
+                    s += a[idx(i, j)] * b[idx(i, j)];
+                }
+            }
+            return s;
+        };
+
+        // boundary nodes are never written and stay at zero
+        std::size_t const n = rhs.size();
+        psi.assign(n, T(0));
+        std::vector<T> r(n, T(0));
+        std::vector<T> Ap(n, T(0));
+        for (int j = 1; j < ny - 1; ++j) {
+            for (int i = 1; i < nx - 1; ++i) {
+                r[idx(i, j)] = rhs[idx(i, j)];
+            }
+        }
+        std::vector<T> p = r;
+
+        PoissonSolveStats stats;
+        T rr = dot(r, r);
+        T const stop_rr = rel_tol * rel_tol * rr;
+        stats.initial_residual = std::sqrt(rr);
+        for (int iter = 0; iter < max_iters && rr > stop_rr; ++iter) {
+            apply_operator(p, Ap);
+            // breakdown: the search direction has no energy left in the operator
+            T const pAp = dot(p, Ap);
+            if (!(pAp > T(0))) { break; }
+            T const alpha = rr / pAp;
+            for (int j = 1; j < ny - 1; ++j) {
+                for (int i = 1; i < nx - 1; ++i) {
+                    psi[idx(i, j)] += alpha * p[idx(i, j)];
+                    r[idx(i, j)] -= alpha * Ap[idx(i, j)];
+                }
+            }
+            T const rr_new = dot(r, r);
+            T const beta = rr_new / rr;
+            for (int j = 1; j < ny - 1; ++j) {
+                for (int i = 1; i < nx - 1; ++i) {
+                    p[idx(i, j)] = r[idx(i, j)] + beta * p[idx(i, j)];
+                }
+            }
+            rr = rr_new;
+            stats.num_iters = iter + 1;
+        }
+        stats.final_residual = std::sqrt(rr);
+
+        return stats;
+    }
+
+    /** Solve the transverse Poisson equation -Laplace_perp(psi) = rhs in mixed precision
+     *
+     * This uses iterative refinement: the residual and the solution are
+     * kept in double precision, while the correction for each residual is
+     * computed with a single precision conjugate gradient solve to a loose
+     * tolerance. The residual is scaled to order unity before the solve,
+     * so that it does not overflow in single precision.
+     *
+     * @param[in] rhs right-hand side, flattened as i + j*nx
+     * @param[out] psi solution, flattened as i + j*nx
+     * @param[in] nx number of nodes in x
+     * @param[in] ny number of nodes in y
+     * @param[in] dx node spacing in x (m)
+     * @param[in] dy node spacing in y (m)
+     * @param[in] rel_tol relative tolerance on the residual norm
+     * @param[in] max_iters maximum number of iterations, summed over all refinements
+     * @return convergence information
+     */
+    PoissonSolveStats
+    solve_transverse_poisson_mixed (
+        std::vector<amrex::Real> const & rhs,
+        std::vector<amrex::Real> & psi,
+        int nx,
+        int ny,
+        amrex::Real dx,
+        amrex::Real dy,
+        amrex::Real rel_tol,
+        int max_iters
+    )
+    {
+        // relative tolerance of each single precision correction
+        float const inner_rel_tol = 1.e-3f;
+        int const max_refinements = 20;
+
+        auto const idx = [nx] (int i, int j) { return i + j * nx; };
+        auto const norm = [&] (std::vector<amrex::Real> const & a) {
+            amrex::Real s = 0.0;
+            for (int j = 1; j < ny - 1; ++j) {
+                for (int i = 1; i < nx - 1; ++i) {
+                    s += a[idx(i, j)] * a[idx(i, j)];
+                }
+            }
+            return std::sqrt(s);
+        };
+
+        std::size_t const n = rhs.size();
+        psi.assign(n, 0.0);
+        std::vector<amrex::Real> r(n, 0.0);
+        std::vector<amrex::Real> Apsi(n, 0.0);
+        std::vector<float> r_sp(n, 0.0f);
+        std::vector<float> e_sp;
+        for (int j = 1; j < ny - 1; ++j) {
+            for (int i = 1; i < nx - 1; ++i) {
+                r[idx(i, j)] = rhs[idx(i, j)];
+            }
+        }
+
+        PoissonSolveStats stats;
+        amrex::Real r_norm = norm(r);
+        amrex::Real const stop_norm = rel_tol * r_norm;
+        stats.initial_residual = r_norm;
+        for (int refinement = 0;
+             refinement < max_refinements && r_norm > stop_norm && stats.num_iters < max_iters;
+             ++refinement)
+        {
+            // correction A e = r in single precision, for the scaled residual
+            amrex::Real r_max = 0.0;
+            for (amrex::Real const v : r) { r_max = std::max(r_max, std::abs(v)); }
+            amrex::Real const inv_r_max = 1.0 / r_max;
+            for (std::size_t m = 0; m < n; ++m) { r_sp[m] = static_cast<float>(r[m] * inv_r_max); }
+
+            PoissonSolveStats const inner = solve_transverse_poisson<float>(
+                r_sp, e_sp, nx, ny, static_cast<float>(dx), static_cast<float>(dy),
+                inner_rel_tol, max_iters - stats.num_iters);
+            stats.num_iters += inner.num_iters;
+
+            for (std::size_t m = 0; m < n; ++m) { psi[m] += static_cast<amrex::Real>(e_sp[m]) * r_max; }
+
+            // residual r = rhs - A psi in double precision
+            apply_transverse_laplacian(psi, Apsi, nx, ny, dx, dy);
+            for (int j = 1; j < ny - 1; ++j) {
+                for (int i = 1; i < nx - 1; ++i) {
+                    r[idx(i, j)] = rhs[idx(i, j)] - Apsi[idx(i, j)];
+                }
+            }
+            r_norm = norm(r);
+        }
+        stats.final_residual = r_norm;
+
+        return stats;
+    }
+} // namespace
+
+    amrex::Vector<PoissonSolveStats>
+    PoissonSolve2p5D (
+        ImpactXParticleContainer const & pc,
+        std::unordered_map<int, amrex::MultiFab> const & rho,
+        std::unordered_map<int, amrex::MultiFab> & phi,
+        bool mixed_precision_fields
+    )
+    {
+        BL_PROFILE("impactx::spacecharge::PoissonSolve2p5D");
+
+        using namespace amrex::literals;
+
+        if (phi.size() != 1u)
+            throw std::runtime_error("PoissonSolve2p5D: the 2.5D space charge model supports only a single refinement level!");
+
+        int const lev = 0;
+        amrex::MultiFab const & rho_at_level = rho.at(lev);
+        amrex::MultiFab & phi_at_level = phi.at(lev);
+
+        // nodal index space of the whole domain
+        amrex::Geometry const & gm = pc.GetParGDB()->Geom(lev);
+        amrex::Box const domain = amrex::convert(gm.Domain(), amrex::IntVect::TheNodeVector());
+        amrex::IntVect const lo = domain.smallEnd();
+        int const lo_x = lo[0], lo_y = lo[1], lo_z = lo[2];
+        int const nx = domain.length(0);
+        int const ny = domain.length(1);
+        int const nz = domain.length(2);
+
+        auto const dr = gm.CellSizeArray();
+        amrex::Real const dz = dr[2];
+        amrex::Real const dxdy = dr[0] * dr[1];
+
+        // project rho onto the transverse plane (C/m^2) and onto the z axis (C/m)
+        //   nodes shared between boxes are only counted by their owner
+        amrex::Gpu::DeviceVector<amrex::Real> d_rho_xy(nx * ny, 0.0_rt);
+        amrex::Gpu::DeviceVector<amrex::Real> d_lambda(nz, 0.0_rt);
+        amrex::Real * const AMREX_RESTRICT rho_xy_ptr = d_rho_xy.data();
+        amrex::Real * const AMREX_RESTRICT lambda_ptr = d_lambda.data();
+
+        auto const owner_mask = rho_at_level.OwnerMask(gm.periodicity());
+        for (amrex::MFIter mfi(rho_at_level); mfi.isValid(); ++mfi) {
+            amrex::Box const bx = mfi.validbox();
+            auto const rho_arr = rho_at_level.const_array(mfi);
+            auto const mask_arr = owner_mask->const_array(mfi);
+
+            amrex::ParallelFor(bx, [=] AMREX_GPU_DEVICE (int i, int j, int k) noexcept {
+                if (mask_arr(i, j, k)) {
+                    amrex::Real const r = rho_arr(i, j, k);
+                    amrex::HostDevice::Atomic::Add(rho_xy_ptr + (i - lo_x) + (j - lo_y) * nx, r * dz);
+                    amrex::HostDevice::Atomic::Add(lambda_ptr + (k - lo_z), r * dxdy);
+                }
+            });
+        }
+
+        std::vector<amrex::Real> rho_xy(nx * ny);
+        std::vector<amrex::Real> lambda(nz);
+        amrex::Gpu::copyAsync(amrex::Gpu::deviceToHost, d_rho_xy.begin(), d_rho_xy.end(), rho_xy.begin());
+        amrex::Gpu::copyAsync(amrex::Gpu::deviceToHost, d_lambda.begin(), d_lambda.end(), lambda.begin());
+        amrex::Gpu::streamSynchronize();
+
+        if (mixed_precision_fields) {
+            // sum the projections in single precision
+            std::vector<float> buf(rho_xy.size() + lambda.size());
+            std::copy(rho_xy.begin(), rho_xy.end(), buf.begin());
+            std::copy(lambda.begin(), lambda.end(), buf.begin() + rho_xy.size());
+            amrex::ParallelAllReduce::Sum(buf.data(), static_cast<int>(buf.size()),
+                                          amrex::ParallelDescriptor::Communicator());
+            std::copy(buf.begin(), buf.begin() + rho_xy.size(), rho_xy.begin());
+            std::copy(buf.begin() + rho_xy.size(), buf.end(), lambda.begin());
+        } else {
+            amrex::ParallelDescriptor::ReduceRealSum(rho_xy.data(), static_cast<int>(rho_xy.size()));
+            amrex::ParallelDescriptor::ReduceRealSum(lambda.data(), static_cast<int>(lambda.size()));
+        }
+
+        // total charge of the beam
+        amrex::Real total_charge = 0.0_rt;
+        for (amrex::Real const l : lambda) { total_charge += l * dz; }
+
+        amrex::Vector<PoissonSolveStats> stats(1);
+        phi_at_level.setVal(0.);
+        if (total_charge == 0.0_rt) { return stats; }
+
+        // transverse Poisson problem for the normalized profile f = rho_xy / Q:
+        //   -Laplace_perp(psi) = f / ep0
+        std::vector<amrex::Real> rhs(nx * ny);
+        amrex::Real const rhs_factor = 1.0_rt / (total_charge * ablastr::constant::SI::ep0);
+        std::transform(rho_xy.begin(), rho_xy.end(), rhs.begin(),
+                       [rhs_factor](amrex::Real const v) { return v * rhs_factor; });
+
+        // the number of CG iterations for the 2D Laplacian grows with the
+        // number of nodes along one direction, not with the number of unknowns
+        amrex::Real const cg_relative_tolerance = 1.e-7;
+        int const cg_max_iters = std::min(nx * ny, 10 * std::max(nx, ny));
+
+        // the transverse problem is small and solved redundantly on every MPI rank,
+        // which avoids a broadcast of the solution
+        std::vector<amrex::Real> psi;
+        if (mixed_precision_fields) {
+            stats[lev] = solve_transverse_poisson_mixed(rhs, psi, nx, ny, dr[0], dr[1],
+                                                        cg_relative_tolerance, cg_max_iters);
+        } else {
+            stats[lev] = solve_transverse_poisson<amrex::Real>(rhs, psi, nx, ny, dr[0], dr[1],
+                                                               cg_relative_tolerance, cg_max_iters);
+        }
+        if (stats[lev].final_residual > cg_relative_tolerance * stats[lev].initial_residual) {
+            ablastr::warn_manager::WMRecordWarning(
+                "Space charge",
+                "PoissonSolve2p5D: the transverse Poisson solve did not converge after " +
+                std::to_string(stats[lev].num_iters) + " iterations (relative residual " +
+                std::to_string(stats[lev].final_residual / stats[lev].initial_residual) + ").",
+                ablastr::warn_manager::WarnPriority::medium
+            );
+        }
+
+        // phi(x,y,z) = lambda(z) * psi(x,y), including guard nodes inside the domain
+        amrex::Gpu::DeviceVector<amrex::Real> d_psi(psi.size());
+        amrex::Gpu::copyAsync(amrex::Gpu::hostToDevice, psi.begin(), psi.end(), d_psi.begin());
+        amrex::Gpu::copyAsync(amrex::Gpu::hostToDevice, lambda.begin(), lambda.end(), d_lambda.begin());
+        amrex::Gpu::streamSynchronize();
+        amrex::Real const * const AMREX_RESTRICT psi_ptr = d_psi.data();
+        amrex::Real const * const AMREX_RESTRICT lambda_c_ptr = d_lambda.data();
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#endif
+        for (amrex::MFIter mfi(phi_at_level, amrex::TilingIfNotGPU()); mfi.isValid(); ++mfi) {
+            amrex::Box const bx = mfi.growntilebox() & domain;
+            auto const phi_arr = phi_at_level.array(mfi);
+
+            amrex::ParallelFor(bx, [=] AMREX_GPU_DEVICE (int i, int j, int k) noexcept {
+                phi_arr(i, j, k) = lambda_c_ptr[k - lo_z] * psi_ptr[(i - lo_x) + (j - lo_y) * nx];
+            });
+        }
+
+        return stats;
+    }
+} // impactx::spacecharge
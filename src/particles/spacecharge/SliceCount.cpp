@@ -0,0 +1,109 @@
+/* Copyright 2022-2023 The Regents of the University of California, through Lawrence
+ *           Berkeley National Laboratory (subject to receipt of any required
+ *           approvals from the U.S. Dept. of Energy). All rights reserved.
+ *
+ * This file is part of ImpactX.
+ *
+ * Authors: Axel Huebl
+ * License: BSD-3-Clause-LBNL
+ */
+#include "SliceCount.H"
+
+#include "particles/diagnostics/ReducedBeamCharacteristics.H"
+
+#include <ablastr/constant.H>
+
+#include <AMReX_BLProfiler.H>
+#include <AMReX_ParallelDescriptor.H>
+#include <AMReX_ParmParse.H>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+namespace impactx::spacecharge
+{
+    SliceCountLimits
+    ReadSliceCountLimits ()
+    {
+        SliceCountLimits limits;
+
+        amrex::ParmParse pp_algo("algo");
+        pp_algo.queryAdd("nslice_auto_phase_advance", limits.max_phase_advance);
+        pp_algo.queryAdd("nslice_auto_size_change", limits.max_size_change);
+        pp_algo.queryAdd("nslice_auto_plasma_fraction", limits.max_plasma_fraction);
+        pp_algo.queryAdd("nslice_min", limits.nslice_min);
+        pp_algo.queryAdd("nslice_max", limits.nslice_max);
+
+        if (limits.max_phase_advance <= 0.0 || limits.max_size_change <= 0.0 || limits.max_plasma_fraction <= 0.0)
+            throw std::runtime_error("algo.nslice_auto_phase_advance, algo.nslice_auto_size_change and "
+                                     "algo.nslice_auto_plasma_fraction must be positive");
+        if (limits.nslice_min < 1 || limits.nslice_max < limits.nslice_min)
+            throw std::runtime_error("algo.nslice_min must be >= 1 and algo.nslice_max must be >= algo.nslice_min");
+
+        return limits;
+    }
+
+    int
+    AutoSliceCount (
+        ImpactXParticleContainer const & pc,
+        amrex::ParticleReal ds,
+        SliceCountLimits const & limits
+    )
+    {
+        BL_PROFILE("impactx::spacecharge::AutoSliceCount");
+
+        using namespace amrex::literals;
+        using ablastr::constant::math::pi;
+
+        if (ds <= 0.0_prt) { return 1; }
+
+        // the reduced beam characteristics are only valid on the IO rank
+        auto const rbc = diagnostics::reduced_beam_characteristics(pc);
+
+        int nslice = limits.nslice_min;
+        if (amrex::ParallelDescriptor::IOProcessor())
+        {
+            RefPart const ref_part = pc.GetRefParticle();
+            amrex::ParticleReal n = 1.0_prt;
+
+            // betatron phase advance per slice: ds / beta
+            amrex::ParticleReal const beta_min = std::min(rbc.at("beta_x"), rbc.at("beta_y"));
+            if (std::isfinite(beta_min) && beta_min > 0.0_prt)
+                n = std::max(n, ds / (beta_min * limits.max_phase_advance));
+
+            // relative change of the rms beam size: |d sigma / ds| / sigma = |alpha| / beta
+            amrex::ParticleReal const size_rate = std::max(
+                std::abs(rbc.at("alpha_x")) / rbc.at("beta_x"),
+                std::abs(rbc.at("alpha_y")) / rbc.at("beta_y"));
+            if (std::isfinite(size_rate))
+                n = std::max(n, ds * size_rate / limits.max_size_change);
+
+            // plasma wavelength of a uniform beam with the rms volume of the bunch
+            amrex::ParticleReal const num_real = std::abs(rbc.at("charge_C") / ref_part.charge);
+            amrex::ParticleReal const beta = ref_part.beta();
+            amrex::ParticleReal const gamma = ref_part.gamma();
+            amrex::ParticleReal const sig_z = beta * rbc.at("sig_t");
+            amrex::ParticleReal const volume =
+                std::pow(2.0_prt * pi, 1.5_prt) * rbc.at("sig_x") * rbc.at("sig_y") * sig_z;
+            if (volume > 0.0_prt && num_real > 0.0_prt)
+            {
+                amrex::ParticleReal const density = num_real / volume;
+                amrex::ParticleReal const omega_p2 = density * ref_part.charge * ref_part.charge /
+                    (ablastr::constant::SI::ep0 * ref_part.mass * gamma * gamma * gamma);
+                amrex::ParticleReal const lambda_p = 2.0_prt * pi * beta * ablastr::constant::SI::c / std::sqrt(omega_p2);
+                if (std::isfinite(lambda_p) && lambda_p > 0.0_prt)
+                    n = std::max(n, ds / (lambda_p * limits.max_plasma_fraction));
+            }
+
+            // clamp before the conversion to int
+            n = std::min(std::max(std::ceil(n), amrex::ParticleReal(limits.nslice_min)),
+                         amrex::ParticleReal(limits.nslice_max));
+            nslice = static_cast<int>(n);
+        }
+        amrex::ParallelDescriptor::Bcast(&nslice, 1, amrex::ParallelDescriptor::IOProcessorNumber());
+
+        return nslice;
+    }
+} // namespace impactx::spacecharge
@@ -0,0 +1,368 @@
+/* Copyright 2022-2023 The Regents of the University of California, through Lawrence
+ *           Berkeley National Laboratory (subject to receipt of any required
+ *           approvals from the U.S. Dept. of Energy). All rights reserved.
+ *
+ * This file is part of ImpactX.
+ *
+ * Authors: Axel Huebl
+ * License: BSD-3-Clause-LBNL
+ */
+#include "SpaceChargeAtFixedS.H"
+
+#include "GatherAndPush.H"
+#include "particles/ShapeFactors.H"
+#include "particles/transformation/ToFixedS.H"
+#include "particles/transformation/ToFixedT.H"
+
+#include <ablastr/constant.H>
+#include <ablastr/particles/NodalFieldGather.H>
+#include <ablastr/utils/Communication.H>
+#include <ablastr/warn_manager/WarnManager.H>
+
+#include <AMReX_BLProfiler.H>
+#include <AMReX_Extension.H>  // for AMREX_RESTRICT
+#include <AMReX_GpuAtomic.H>
+#include <AMReX_GpuUtility.H>   // for Gpu::DeviceScalar
+#include <AMReX_IntVect.H>
+#include <AMReX_REAL.H>       // for Real
+#include <AMReX_SPACE.H>      // for AMREX_D_DECL
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace impactx::spacecharge
+{
+namespace detail
+{
+    using ParticleTileType = ImpactXParticleContainer::ParticleTileType;
+
+    /** Keys of all non-empty particle tiles on a level
+     *
+     * Particles are not redistributed at fixed s, so we loop over the
+     * particle tiles directly instead of over the boxes of the mesh.
+     */
+    std::vector<std::pair<int, int>>
+    particle_tile_keys (ImpactXParticleContainer & pc, int lev)
+    {
+        std::vector<std::pair<int, int>> tile_keys;
+        for (auto const & kv : pc.GetParticles(lev)) {
+            if (kv.second.numParticles() > 0) { tile_keys.push_back(kv.first); }
+        }
+        return tile_keys;
+    }
+
+    /** Local index of the box a particle tile belongs to
+     *
+     * @param mf field on the same BoxArray as the particles
+     * @param grid global index of the box
+     */
+    int
+    local_box_index (amrex::MultiFab const & mf, int grid)
+    {
+        int const li = mf.localindex(grid);
+        if (li < 0)
+            throw std::runtime_error("Space charge at fixed s: all boxes of the mesh must be local to this process");
+        return li;
+    }
+
+    /** Deposit the charge of the particles of one tile at fixed s
+     *
+     * The weight of particles whose shape is not within the box and its
+     * guard cells is added to dropped_weight instead.
+     *
+     * @tparam depos_order the order of the particle shape
+     */
+    template <int depos_order>
+    void
+    deposit_tile_at_fixed_s (
+        ParticleTileType & ptile,
+        RealUniformAccessor const part_w,
+        amrex::FArrayBox & rho_fab,
+        transformation::ToFixedT const & to_t,
+        amrex::ParticleReal const charge,
+        amrex::GpuArray<amrex::Real, 3> const & invdr,
+        amrex::GpuArray<amrex::Real, 3> const & prob_lo,
+        amrex::Real * const dropped_weight
+    )
+    {
+        using namespace amrex::literals;
+
+        const int np = ptile.numParticles();
+
+        // preparing access to particle data
+        using PType = ImpactXParticleContainer::ParticleType;
+        PType const * const AMREX_RESTRICT aos_ptr = ptile.GetArrayOfStructs()().dataPtr();
+        auto & soa_real = ptile.GetStructOfArrays();
+        amrex::ParticleReal const * const AMREX_RESTRICT part_px = soa_real.GetRealData(RealSoA::px).dataPtr();
+        amrex::ParticleReal const * const AMREX_RESTRICT part_py = soa_real.GetRealData(RealSoA::py).dataPtr();
+        amrex::ParticleReal const * const AMREX_RESTRICT part_pt = soa_real.GetRealData(RealSoA::pt).dataPtr();
+        auto const ptd = ptile.getConstParticleTileData();
+
+        auto const rho_arr = rho_fab.array();
+        amrex::Box const rho_box = rho_fab.box();
+        amrex::Real const invvol = invdr[0] * invdr[1] * invdr[2];
+
+        amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) {
+            // position at fixed t of a copy of the particle
+            PType p = aos_ptr[i];
+            amrex::ParticleReal px = part_px[i];
+            amrex::ParticleReal py = part_py[i];
+            amrex::ParticleReal pt = part_pt[i];
+            to_t(p, px, py, pt);
+
+            amrex::Real sx[depos_order + 1], sy[depos_order + 1], sz[depos_order + 1];
+            int const i0 = ShapeFactor<depos_order>{}(sx, (p.pos(RealAoS::x) - prob_lo[0]) * invdr[0]);
+            int const j0 = ShapeFactor<depos_order>{}(sy, (p.pos(RealAoS::y) - prob_lo[1]) * invdr[1]);
+            int const k0 = ShapeFactor<depos_order>{}(sz, (p.pos(RealAoS::z) - prob_lo[2]) * invdr[2]);
+
+            // particles outside of the box and its guard cells are not deposited
+            if (!rho_box.contains(amrex::IntVect(i0, j0, k0)) ||
+                !rho_box.contains(amrex::IntVect(i0 + depos_order, j0 + depos_order, k0 + depos_order))) {
+                amrex::HostDevice::Atomic::Add(dropped_weight, amrex::Real(part_w(ptd, i)));
+                return;
+            }
+
+            amrex::Real const wq = charge * part_w(ptd, i) * invvol;
+            for (int kk = 0; kk <= depos_order; ++kk) {
+                for (int jj = 0; jj <= depos_order; ++jj) {
+                    for (int ii = 0; ii <= depos_order; ++ii) {
+                        amrex::HostDevice::Atomic::Add(
+                            &rho_arr(i0 + ii, j0 + jj, k0 + kk),
+                            sx[ii] * sy[jj] * sz[kk] * wq);
+                    }
+                }
+            }
+        });
+    }
+
+    /** Gather the field and push the particles of one tile at fixed s
+     *
+     * @tparam F functor that returns the field in x,y,z at a position at fixed t
+     */
+    template <typename F>
+    void
+    push_tile_at_fixed_s (
+        ParticleTileType & ptile,
+        F const & field_at,
+        transformation::ToFixedT const & to_t,
+        transformation::ToFixedS const & to_s,
+        amrex::ParticleReal const push_consts
+    )
+    {
+        const int np = ptile.numParticles();
+
+        // preparing access to particle data
+        using PType = ImpactXParticleContainer::ParticleType;
+        PType * const AMREX_RESTRICT aos_ptr = ptile.GetArrayOfStructs()().dataPtr();
+        auto & soa_real = ptile.GetStructOfArrays();
+        amrex::ParticleReal * const AMREX_RESTRICT part_px = soa_real.GetRealData(RealSoA::px).dataPtr();
+        amrex::ParticleReal * const AMREX_RESTRICT part_py = soa_real.GetRealData(RealSoA::py).dataPtr();
+        amrex::ParticleReal * const AMREX_RESTRICT part_pt = soa_real.GetRealData(RealSoA::pt).dataPtr();
+
+        amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE (int i) {
+            // transform a copy of the particle to fixed t
+            PType p = aos_ptr[i];
+            amrex::ParticleReal px = part_px[i];
+            amrex::ParticleReal py = part_py[i];
+            amrex::ParticleReal pz = part_pt[i];
+            to_t(p, px, py, pz);
+
+            // gather and push momentum
+            amrex::GpuArray<amrex::Real, 3> const field_interp =
+                field_at(p.pos(RealAoS::x), p.pos(RealAoS::y), p.pos(RealAoS::z));
+            px += field_interp[0] * push_consts;
+            py += field_interp[1] * push_consts;
+            pz += field_interp[2] * push_consts;
+
+            // transform back to fixed s
+            to_s(p, px, py, pz);
+            aos_ptr[i].pos(RealAoS::x) = p.pos(RealAoS::x);
+            aos_ptr[i].pos(RealAoS::y) = p.pos(RealAoS::y);
+            aos_ptr[i].pos(RealAoS::t) = p.pos(RealAoS::t);
+            part_px[i] = px;
+            part_py[i] = py;
+            part_pt[i] = pz;  // pt is stored in the same memory slot as pz
+        });
+    }
+} // namespace detail
+
+    void DepositChargeAtFixedS (
+        ImpactXParticleContainer & pc,
+        std::unordered_map<int, amrex::MultiFab> & rho,
+        bool const mixed_precision_fields
+    )
+    {
+        BL_PROFILE("impactx::spacecharge::DepositChargeAtFixedS");
+
+        using namespace amrex::literals;
+
+        amrex::ParticleReal const charge = pc.GetRefParticle().charge;
+        int const particle_shape = pc.GetParticleShape();
+        transformation::ToFixedT const to_t(pc.GetRefParticle().pt);
+
+        // loop over refinement levels
+        int const nLevel = pc.finestLevel();
+        for (int lev = 0; lev <= nLevel; ++lev)
+        {
+            amrex::MultiFab & rho_at_level = rho.at(lev);
+            rho_at_level.setVal(0.);
+
+            // get simulation geometry information
+            auto const & gm = pc.Geom(lev);
+            auto const dr = gm.CellSizeArray();
+            amrex::GpuArray<amrex::Real, 3> const invdr{AMREX_D_DECL(1_rt/dr[0], 1_rt/dr[1], 1_rt/dr[2])};
+            const auto prob_lo = gm.ProbLoArray();
+
+            auto & particles_at_level = pc.GetParticles(lev);
+            std::vector<std::pair<int, int>> const tile_keys = detail::particle_tile_keys(pc, lev);
+            RealUniformAccessor const part_w = pc.GetRealAttribute(RealUniform::w);
+
+            // weight of the particles that are not in the box of their tile
+            amrex::Gpu::DeviceScalar<amrex::Real> dropped_weight(0.0_rt);
+            amrex::Real * const dropped_weight_ptr = dropped_weight.dataPtr();
+
+            // tiles of the same box deposit to the same FAB: this uses atomics
+#ifdef AMREX_USE_OMP
+#pragma omp parallel for schedule(dynamic) if (amrex::Gpu::notInLaunchRegion())
+#endif
+            for (int t = 0; t < static_cast<int>(tile_keys.size()); ++t) {
+                auto & ptile = particles_at_level.at(tile_keys[t]);
+                amrex::FArrayBox & rho_fab = rho_at_level[detail::local_box_index(rho_at_level, tile_keys[t].first)];
+
+                switch (particle_shape) {
+                    case 1:
+                        detail::deposit_tile_at_fixed_s<1>(ptile, part_w, rho_fab, to_t, charge, invdr, prob_lo, dropped_weight_ptr);
+                        break;
+                    case 2:
+                        detail::deposit_tile_at_fixed_s<2>(ptile, part_w, rho_fab, to_t, charge, invdr, prob_lo, dropped_weight_ptr);
+                        break;
+                    case 3:
+                        detail::deposit_tile_at_fixed_s<3>(ptile, part_w, rho_fab, to_t, charge, invdr, prob_lo, dropped_weight_ptr);
+                        break;
+                    default:
+                        throw std::runtime_error("DepositChargeAtFixedS: particle shape must be 1, 2 or 3");
+                }
+            }
+
+            amrex::Real const dropped_charge = std::abs(charge) * dropped_weight.dataValue();
+            if (dropped_charge > 0.0_rt) {
+                ablastr::warn_manager::WMRecordWarning(
+                    "ImpactX::spacecharge::DepositChargeAtFixedS",
+                    "A charge of " + std::to_string(dropped_charge) + " C on level " + std::to_string(lev) +
+                    " was not deposited, because the particles are outside of the box of their tile.",
+                    ablastr::warn_manager::WarnPriority::high
+                );
+            }
+
+            // sum neighboring contributions
+            ablastr::utils::communication::SumBoundary(
+                rho_at_level, 0, rho_at_level.nComp(), rho_at_level.nGrowVect(),
+                mixed_precision_fields, gm.periodicity());
+        }
+    }
+
+    void GatherAndPushAtFixedS (
+        ImpactXParticleContainer & pc,
+        std::unordered_map<int, std::unordered_map<std::string, amrex::MultiFab> > const & space_charge_field,
+        std::unordered_map<int, amrex::MultiFab> & phi,
+        amrex::Vector<amrex::Geometry> const & geom,
+        amrex::ParticleReal const slice_ds,
+        bool const from_potential,
+        bool const mixed_precision_fields
+    )
+    {
+        BL_PROFILE("impactx::spacecharge::GatherAndPushAtFixedS");
+
+        using namespace amrex::literals;
+
+        amrex::ParticleReal const charge = pc.GetRefParticle().charge;
+        int const particle_shape = pc.GetParticleShape();
+
+        // physical constants and reference quantities
+        amrex::ParticleReal const c0_SI = ablastr::constant::SI::c;
+        amrex::ParticleReal const mc_SI = pc.GetRefParticle().mass * c0_SI;
+        amrex::ParticleReal const pz_ref_SI = pc.GetRefParticle().beta_gamma() * mc_SI;
+        amrex::ParticleReal const gamma = pc.GetRefParticle().gamma();
+        amrex::ParticleReal const inv_gamma2 = 1.0_prt / (gamma * gamma);
+
+        amrex::ParticleReal const dt = slice_ds / pc.GetRefParticle().beta() / c0_SI;
+
+        // group together constants for the momentum push
+        amrex::ParticleReal const push_consts = dt * charge * inv_gamma2 / pz_ref_SI;
+
+        // transformations to fixed t and back to fixed s
+        amrex::ParticleReal const pd = pc.GetRefParticle().pt;  // Design value of pt/mc2 = -gamma
+        transformation::ToFixedT const to_t(pd);
+        transformation::ToFixedS const to_s(std::sqrt(pd * pd - 1.0_prt));
+
+        // loop over refinement levels
+        int const nLevel = pc.finestLevel();
+        for (int lev = 0; lev <= nLevel; ++lev)
+        {
+            // get simulation geometry information
+            auto const & gm = geom[lev];
+            auto const dr = gm.CellSizeArray();
+            amrex::GpuArray<amrex::Real, 3> const invdr{AMREX_D_DECL(1_rt/dr[0], 1_rt/dr[1], 1_rt/dr[2])};
+            const auto prob_lo = gm.ProbLoArray();
+
+            // the shape of particles close to a box boundary reaches into the guard cells
+            amrex::MultiFab & phi_at_level = phi.at(lev);
+            if (from_potential) {
+                ablastr::utils::communication::FillBoundary(
+                    phi_at_level, mixed_precision_fields, gm.periodicity());
+            }
+
+            auto & particles_at_level = pc.GetParticles(lev);
+            std::vector<std::pair<int, int>> const tile_keys = detail::particle_tile_keys(pc, lev);
+            RealUniformAccessor const part_w = pc.GetRealAttribute(RealUniform::w);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel for schedule(dynamic) if (amrex::Gpu::notInLaunchRegion())
+#endif
+            for (int t = 0; t < static_cast<int>(tile_keys.size()); ++t) {
+                auto & ptile = particles_at_level.at(tile_keys[t]);
+                int const li = detail::local_box_index(phi_at_level, tile_keys[t].first);
+
+                if (from_potential) {
+                    auto const phi_arr = phi_at_level[li].const_array();
+                    switch (particle_shape) {
+                        case 1:
+                            detail::push_tile_at_fixed_s(ptile,
+                                [=] AMREX_GPU_DEVICE (amrex::ParticleReal x, amrex::ParticleReal y, amrex::ParticleReal z) {
+                                    return FieldFromPotentialNodal<1>(x, y, z, phi_arr, invdr, prob_lo);
+                                }, to_t, to_s, push_consts);
+                            break;
+                        case 2:
+                            detail::push_tile_at_fixed_s(ptile,
+                                [=] AMREX_GPU_DEVICE (amrex::ParticleReal x, amrex::ParticleReal y, amrex::ParticleReal z) {
+                                    return FieldFromPotentialNodal<2>(x, y, z, phi_arr, invdr, prob_lo);
+                                }, to_t, to_s, push_consts);
+                            break;
+                        case 3:
+                            detail::push_tile_at_fixed_s(ptile,
+                                [=] AMREX_GPU_DEVICE (amrex::ParticleReal x, amrex::ParticleReal y, amrex::ParticleReal z) {
+                                    return FieldFromPotentialNodal<3>(x, y, z, phi_arr, invdr, prob_lo);
+                                }, to_t, to_s, push_consts);
+                            break;
+                        default:
+                            throw std::runtime_error("GatherAndPushAtFixedS: particle shape must be 1, 2 or 3");
+                    }
+                } else {
+                    // TODO: This is currently using linear order.
+                    auto const scf_arr_x = space_charge_field.at(lev).at("x")[li].const_array();
+                    auto const scf_arr_y = space_charge_field.at(lev).at("y")[li].const_array();
+                    auto const scf_arr_z = space_charge_field.at(lev).at("z")[li].const_array();
+                    detail::push_tile_at_fixed_s(ptile,
+                        [=] AMREX_GPU_DEVICE (amrex::ParticleReal x, amrex::ParticleReal y, amrex::ParticleReal z) {
+                            return ablastr::particles::doGatherVectorFieldNodal(
+                                x, y, z, scf_arr_x, scf_arr_y, scf_arr_z, invdr, prob_lo);
+                        }, to_t, to_s, push_consts);
+                }
+            }
+        }
+    }
+} // namespace impactx::spacecharge
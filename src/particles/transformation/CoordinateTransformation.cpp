@@ -12,11 +12,19 @@
 #include "ToFixedS.H"
 #include "ToFixedT.H"
 
+#include "particles/ParallelForParticles.H"
+
 #include <AMReX_BLProfiler.H> // for BL_PROFILE
 #include <AMReX_Extension.H>  // for AMREX_RESTRICT
+#include <AMReX_ParallelDescriptor.H>   // for ParallelDescriptor
+#include <AMReX_ParticleReduce.H>       // for ParticleReduce
 #include <AMReX_REAL.H>       // for ParticleReal
+#include <AMReX_Reduce.H>               // for ReduceOps
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <vector>
 
 
 namespace impactx
@@ -38,7 +46,7 @@ namespace transformation {
             // loop over all particle boxes
             using ParIt = ImpactXParticleContainer::iterator;
 #ifdef AMREX_USE_OMP
-#pragma omp parallel if (amrex::Gpu::notInLaunchRegion())
+#pragma omp parallel if (amrex::Gpu::notInLaunchRegion() && ThreadOverTiles(pc, lev))
 #endif
             for (ParIt pti(pc, lev); pti.isValid(); ++pti) {
                 const int np = pti.numParticles();
@@ -62,7 +70,7 @@ namespace transformation {
                     amrex::ParticleReal const pzd = sqrt(pow(pd, 2) - 1.0);
 
                     ToFixedS const to_s(pzd);
-                    amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE(long i) {
+                    ParallelForParticles(np, [=] AMREX_GPU_DEVICE(long i) {
                         // access AoS data such as positions and cpu/id
                         PType &p = aos_ptr[i];
 
@@ -80,7 +88,7 @@ namespace transformation {
 
                     amrex::ParticleReal const ptd = pd;  // Design value of pt/mc2 = -gamma.
                     ToFixedT const to_t(ptd);
-                    amrex::ParallelFor(np, [=] AMREX_GPU_DEVICE(long i) {
+                    ParallelForParticles(np, [=] AMREX_GPU_DEVICE(long i) {
                         // access AoS data such as positions and cpu/id
                         PType &p = aos_ptr[i];
 
@@ -95,5 +103,129 @@ namespace transformation {
             } // end loop over all particle boxes
         } // env mesh-refinement level loop
     }
+
+    std::tuple<
+        amrex::ParticleReal, amrex::ParticleReal,
+        amrex::ParticleReal, amrex::ParticleReal,
+        amrex::ParticleReal, amrex::ParticleReal>
+    MinAndMaxPositionsFixedT (ImpactXParticleContainer const & pc)
+    {
+        BL_PROFILE("impactx::transformation::MinAndMaxPositionsFixedT");
+
+        using PType = ImpactXParticleContainer::ParticleType;
+        using PTDType = ImpactXParticleContainer::ParticleTileType::ConstParticleTileDataType;
+        using amrex::ParticleReal;
+
+        ToFixedT const to_t(pc.GetRefParticle().pt);
+        RealUniformAccessor const part_w = pc.GetRealAttribute(RealUniform::w);
+
+        amrex::ReduceOps<
+            amrex::ReduceOpMin, amrex::ReduceOpMin, amrex::ReduceOpMin,
+            amrex::ReduceOpMax, amrex::ReduceOpMax, amrex::ReduceOpMax
+        > reduce_ops;
+        auto r = amrex::ParticleReduce<
+            amrex::ReduceData<
+                ParticleReal, ParticleReal, ParticleReal,
+                ParticleReal, ParticleReal, ParticleReal
+            >
+        >(
+            pc,
+            [=] AMREX_GPU_DEVICE (const SPType& sp) noexcept
+            -> amrex::GpuTuple<
+                ParticleReal, ParticleReal, ParticleReal,
+                ParticleReal, ParticleReal, ParticleReal
+            >
+            {
+                // transform a copy of the particle
+                PType p;
+                p.pos(RealAoS::x) = sp.pos(RealAoS::x);
+                p.pos(RealAoS::y) = sp.pos(RealAoS::y);
+                p.pos(RealAoS::t) = sp.pos(RealAoS::t);
+                ParticleReal px = sp.rdata(RealSoA::px);
+                ParticleReal py = sp.rdata(RealSoA::py);
+                ParticleReal pt = sp.rdata(RealSoA::pt);
+                to_t(p, px, py, pt);
+
+                return {p.pos(RealAoS::x), p.pos(RealAoS::y), p.pos(RealAoS::z),
+                        p.pos(RealAoS::x), p.pos(RealAoS::y), p.pos(RealAoS::z)};
+            },
+            reduce_ops
+        );
+
+        std::vector<ParticleReal> xyz_min = {amrex::get<0>(r), amrex::get<1>(r), amrex::get<2>(r)};
+        std::vector<ParticleReal> xyz_max = {amrex::get<3>(r), amrex::get<4>(r), amrex::get<5>(r)};
+        amrex::ParallelAllReduce::Min(xyz_min.data(), xyz_min.size(), amrex::ParallelDescriptor::Communicator());
+        amrex::ParallelAllReduce::Max(xyz_max.data(), xyz_max.size(), amrex::ParallelDescriptor::Communicator());
+
+        return {xyz_min[0], xyz_min[1], xyz_min[2], xyz_max[0], xyz_max[1], xyz_max[2]};
+    }
+
+    std::tuple<
+        amrex::ParticleReal, amrex::ParticleReal,
+        amrex::ParticleReal, amrex::ParticleReal,
+        amrex::ParticleReal, amrex::ParticleReal>
+    MeanAndStdPositionsFixedT (ImpactXParticleContainer const & pc)
+    {
+        BL_PROFILE("impactx::transformation::MeanAndStdPositionsFixedT");
+
+        using namespace amrex::literals;
+        using PType = ImpactXParticleContainer::ParticleType;
+        using PTDType = ImpactXParticleContainer::ParticleTileType::ConstParticleTileDataType;
+        using amrex::ParticleReal;
+
+        ToFixedT const to_t(pc.GetRefParticle().pt);
+        RealUniformAccessor const part_w = pc.GetRealAttribute(RealUniform::w);
+
+        amrex::ReduceOps<
+            amrex::ReduceOpSum, amrex::ReduceOpSum, amrex::ReduceOpSum, amrex::ReduceOpSum,
+            amrex::ReduceOpSum, amrex::ReduceOpSum, amrex::ReduceOpSum
+        > reduce_ops;
+        // accumulate in amrex::Real, also for single precision particles
+        using amrex::Real;
+        auto r = amrex::ParticleReduce<
+            amrex::ReduceData<
+                Real, Real, Real, Real,
+                Real, Real, Real
+            >
+        >(
+            pc,
+            [=] AMREX_GPU_DEVICE (const PTDType& ptd, const int i) noexcept
+            -> amrex::GpuTuple<
+                Real, Real, Real, Real,
+                Real, Real, Real
+            >
+            {
+                // transform a copy of the particle
+                PType p = ptd.m_aos[i];
+                ParticleReal px = ptd.m_rdata[RealSoA::px][i];
+                ParticleReal py = ptd.m_rdata[RealSoA::py][i];
+                ParticleReal pt = ptd.m_rdata[RealSoA::pt][i];
+                to_t(p, px, py, pt);
+
+                Real const w = part_w(ptd, i);
+                Real const x = p.pos(RealAoS::x);
+                Real const y = p.pos(RealAoS::y);
+                Real const z = p.pos(RealAoS::z);
+                return {w, w * x, w * y, w * z, w * x * x, w * y * y, w * z * z};
+            },
+            reduce_ops
+        );
+
+        std::vector<Real> sums = {
+            amrex::get<0>(r), amrex::get<1>(r), amrex::get<2>(r), amrex::get<3>(r),
+            amrex::get<4>(r), amrex::get<5>(r), amrex::get<6>(r)
+        };
+        amrex::ParallelAllReduce::Sum(sums.data(), sums.size(), amrex::ParallelDescriptor::Communicator());
+
+        Real const w_sum = sums[0];
+        if (w_sum <= 0.0_rt) { return {0.0_prt, 0.0_prt, 0.0_prt, 0.0_prt, 0.0_prt, 0.0_prt}; }
+
+        std::array<Real, 3> mean, sigma;
+        for (int d = 0; d < 3; ++d) {
+            mean[d] = sums[1 + d] / w_sum;
+            sigma[d] = std::sqrt(std::max(sums[4 + d] / w_sum - mean[d] * mean[d], 0.0_rt));
+        }
+        return {mean[0], sigma[0], mean[1], sigma[1], mean[2], sigma[2]};
+    }
 } // namespace transformation
 } // namespace impactx
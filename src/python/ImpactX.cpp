@@ -187,6 +187,16 @@ void init_ImpactX (py::module& m)
              },
              "Enable or disable space charge calculations (default: enabled)."
         )
+        .def_property("space_charge_model",
+             [](ImpactX & /* ix */) {
+                 return detail::get_or_throw<std::string>("algo", "space_charge_model");
+             },
+             [](ImpactX & /* ix */, std::string const model) {
+                 amrex::ParmParse pp_algo("algo");
+                 pp_algo.add("space_charge_model", model);
+             },
+             "The space charge model: 3D (default) or 2.5D."
+        )
         .def_property("diagnostics",
              [](ImpactX & /* ix */) {
                  return detail::get_or_throw<bool>("diag", "enable");
@@ -281,7 +291,9 @@ void init_ImpactX (py::module& m)
         )
         // TODO: step
         .def("resize_mesh", &ImpactX::ResizeMesh,
-             "Resize the mesh :py:attr:`~domain` based on the :py:attr:`~dynamic_size` and related parameters."
+             py::arg("particles_at_fixed_s") = false,
+             "Resize the mesh :py:attr:`~domain` based on the :py:attr:`~dynamic_size` and related parameters.\n"
+             "Returns the maximum shift of the mesh edges in cells, or -1 if the mesh was set from scratch."
         )
 
         .def("particle_container",
@@ -307,12 +319,16 @@ void init_ImpactX (py::module& m)
         )
         .def(
             "space_charge_field",
-            [](ImpactX & ix, int const lev, std::string const comp) {
+            [](ImpactX & ix, int const lev, std::string const comp) -> amrex::MultiFab * {
+                // the level exists, but the force is not allocated for algo.field_gather = potential
+                if (ix.m_phi.count(lev) != 0u && ix.m_space_charge_field.count(lev) == 0u) {
+                    return nullptr;
+                }
                 return &ix.m_space_charge_field.at(lev).at(comp);
             },
             py::arg("lev"), py::arg("comp"),
             py::return_value_policy::reference_internal,
-            "space charge force (vector: x,y,z) per level"
+            "space charge force (vector: x,y,z) per level, None for algo.field_gather = potential"
         )
         .def_readwrite("lattice",
             &ImpactX::m_lattice,
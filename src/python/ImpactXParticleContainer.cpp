@@ -44,7 +44,17 @@ void init_impactxparticlecontainer(py::module& m)
     >(m, "ImpactXParticleContainer")
         //.def(py::init<>())
         .def("add_n_particles",
-             &ImpactXParticleContainer::AddNParticles,
+             py::overload_cast<
+                 int,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::ParticleReal const &,
+                 amrex::ParticleReal const &
+             >(&ImpactXParticleContainer::AddNParticles),
              py::arg("lev"),
              py::arg("x"), py::arg("y"), py::arg("t"),
              py::arg("px"), py::arg("py"), py::arg("pt"),
@@ -63,6 +73,33 @@ void init_impactxparticlecontainer(py::module& m)
              ":param qm: charge over mass in 1/eV\n"
              ":param bchchg: total charge within a bunch in C"
         )
+        .def("add_n_particles",
+             py::overload_cast<
+                 int,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::Vector<amrex::ParticleReal> const &,
+                 amrex::ParticleReal const &,
+                 amrex::Vector<amrex::ParticleReal> const &
+             >(&ImpactXParticleContainer::AddNParticles),
+             py::arg("lev"),
+             py::arg("x"), py::arg("y"), py::arg("t"),
+             py::arg("px"), py::arg("py"), py::arg("pt"),
+             py::arg("qm"), py::arg("w"),
+             "Add new particles with individual weightings to the container for fixed s.\n\n"
+             ":param lev: mesh-refinement level\n"
+             ":param x: positions in x\n"
+             ":param y: positions in y\n"
+             ":param t: positions as time-of-flight in c*t\n"
+             ":param px: momentum in x\n"
+             ":param py: momentum in y\n"
+             ":param pt: momentum in t\n"
+             ":param qm: charge over mass in 1/eV\n"
+             ":param w: weighting of each particle, in number of physical particles"
+        )
         .def("ref_particle",
             py::overload_cast<>(&ImpactXParticleContainer::GetRefParticle),
             py::return_value_policy::reference_internal,
@@ -83,6 +120,29 @@ void init_impactxparticlecontainer(py::module& m)
              "Compute the mean and std of the particle position in each dimension.\n\n"
              ":return: x_mean, x_std, y_mean, y_std, z_mean, z_std"
         )
+        .def("uniform_real_attribute",
+             &ImpactXParticleContainer::GetUniformRealAttribute,
+             py::arg("comp"),
+             "Get the value of an attribute that is the same for all particles.\n\n"
+             "The charge over mass (index 0) and the weighting (index 1) are stored once\n"
+             "per container while all added particles share the same value, and per\n"
+             "particle only once they vary.\n\n"
+             ":param comp: index of the attribute, 0: charge over mass, 1: weighting\n"
+             ":return: the value of all particles, or None if the attribute varies"
+        )
+        .def("set_real_attribute_varying",
+             &ImpactXParticleContainer::SetRealAttributeVarying,
+             py::arg("comp"),
+             "Store an attribute per particle instead of once per container.\n\n"
+             "Call this before changing the attribute of individual particles, e.g., the weighting.\n\n"
+             ":param comp: index of the attribute, 0: charge over mass, 1: weighting"
+        )
+        .def("sync_real_attributes",
+             &ImpactXParticleContainer::SyncRealAttributes,
+             "Make the per-particle storage of the charge over mass and the weighting\n"
+             "the same on all MPI ranks.\n\n"
+             "This is collective. It is called at the start of ImpactX.evolve."
+        )
         .def("reduced_beam_characteristics",
              [](ImpactXParticleContainer & pc) {
                  return diagnostics::reduced_beam_characteristics(pc);